@@ -9,7 +9,27 @@
 #include <stdlib.h>
 #include <algorithm>
 #include <unordered_set>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <chrono>
+#include <random>
 #include <Windows.h>
+#ifdef SU_PROFILE
+#	if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#		include <intrin.h>
+#		define SU_PROF_RDTSC
+#	elif defined(__x86_64__) || defined(__i386__)
+#		include <x86intrin.h>
+#		define SU_PROF_RDTSC
+#	endif
+#endif
+#ifdef __AVX2__
+#	include <immintrin.h>
+#endif
 
 const char su_SampleGridA[] = {
 	" 3 6  4  \n"
@@ -55,12 +75,196 @@ enum TEXTATTR_ {
 };
 typedef int TEXTATTRS;
 
+// stepSolve() が使う手筋
+enum SU_TECH_ {
+	SU_TECH_NONE = 0,
+	SU_TECH_LAST_IN_ROW,   // 横一列の最後の空きマス
+	SU_TECH_LAST_IN_COL,   // 縦一列の最後の空きマス
+	SU_TECH_LAST_IN_BLOCK, // ブロックの最後の空きマス
+	SU_TECH_ROW_UQ,        // 横一列の中で num が入るマスが１つしかない
+	SU_TECH_COL_UQ,        // 縦一列の中で num が入るマスが１つしかない
+	SU_TECH_CELL_UQ,       // マスに入る数字が１つしかない
+	SU_TECH_BLOCK_UQ,      // ブロックの中で num が入るマスが１つしかない
+	SU_TECH_COUNT
+};
+
+// 手筋の難しさ。stepSolve() に最大レベルを指定すると、それより難しい手筋は使わない
+enum SU_LEVEL_ {
+	SU_LEVEL_NONE   = 0, // 解けない
+	SU_LEVEL_EASY   = 1, // 空きマスが１つしかない行・列・ブロックだけで解ける
+	SU_LEVEL_NORMAL = 2, // 行・列・ブロックの中で数字の入る場所が１つしかない（隠れシングル）
+	SU_LEVEL_HARD   = 3, // マスに入る数字が１つしかない（裸のシングル）
+	SU_LEVEL_MAX = SU_LEVEL_HARD,
+};
+
+// 計測対象。SU_TECH_xxx はそのまま手筋ごとの計測に使う
+enum SU_PROF_ {
+	SU_PROF_STEPSOLVE = SU_TECH_COUNT,
+	SU_PROF_SET,
+	SU_PROF_CANSOLVE,
+	SU_PROF_REMOVERANDOMONE,
+	SU_PROF_SEARCH,          // DLX の探索（count・enumerate・findRandom の呼び出しとノード数）
+	SU_PROF_COUNT
+};
+
+#ifdef SU_PROFILE
+// 計測値（SU_PROFILE を定義したときだけ存在する）
+struct SU_PROFILE_ENTRY {
+	std::atomic<unsigned long long> calls;  // 呼ばれた回数
+	std::atomic<unsigned long long> hits;   // 成功した回数（数字が確定した、問題が解けた、など）
+	std::atomic<unsigned long long> cycles; // 消費した時間（x86 ならCPUサイクル数、それ以外はナノ秒）
+	std::atomic<unsigned long long> nodes;  // 探索したノード数（探索する処理だけ）
+};
+static SU_PROFILE_ENTRY su_Profile[SU_PROF_COUNT];
+static const std::chrono::steady_clock::time_point su_ProfileStart = std::chrono::steady_clock::now();
+
+// 時刻。x86 ならタイムスタンプカウンタ、それ以外は steady_clock のナノ秒
+static inline unsigned long long su_ProfileTicks() {
+#ifdef SU_PROF_RDTSC
+	return __rdtsc();
+#else
+	return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// スコープを抜けるまでの呼び出し回数とサイクル数を記録する
+class CSudokuProfScope {
+	int m_id;
+	unsigned long long m_start;
+public:
+	explicit CSudokuProfScope(int id) {
+		m_id = id;
+		m_start = su_ProfileTicks();
+		su_Profile[id].calls.fetch_add(1, std::memory_order_relaxed);
+	}
+	~CSudokuProfScope() {
+		su_Profile[m_id].cycles.fetch_add(su_ProfileTicks() - m_start, std::memory_order_relaxed);
+	}
+};
+
+#ifndef SU_NO_MAIN // 出力するのは main() からだけ
+static const char *su_ProfileNames[SU_PROF_COUNT] = {
+	"none",
+	"step_last_cell_in_row",
+	"step_last_cell_in_col",
+	"step_last_cell_in_block",
+	"step_row_uq",
+	"step_col_uq",
+	"step_cell_uq",
+	"step_block_uq",
+	"stepSolve",
+	"set",
+	"canSolve",
+	"removeRandomOne",
+	"search",
+};
+
+// ノード数を数える処理か？（それ以外は JSON に nodes を出さない）
+static bool su_ProfileCountsNodes(int id) {
+	return id == SU_PROF_CANSOLVE || id == SU_PROF_REMOVERANDOMONE || id == SU_PROF_SEARCH;
+}
+
+// 計測値を JSON で出力する
+static void su_ProfileDump(FILE *fp) {
+	long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - su_ProfileStart).count();
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"wall_ns\": %lld,\n", ns);
+#ifdef SU_PROF_RDTSC
+	fprintf(fp, "  \"cycles_unit\": \"tsc\",\n");
+#else
+	fprintf(fp, "  \"cycles_unit\": \"ns\",\n");
+#endif
+	fprintf(fp, "  \"counters\": {\n");
+	for (int i=1; i<SU_PROF_COUNT; i++) {
+		fprintf(fp, "    \"%s\": {\"calls\": %llu, \"hits\": %llu, \"cycles\": %llu",
+			su_ProfileNames[i],
+			su_Profile[i].calls.load(),
+			su_Profile[i].hits.load(),
+			su_Profile[i].cycles.load());
+		if (su_ProfileCountsNodes(i)) {
+			fprintf(fp, ", \"nodes\": %llu", su_Profile[i].nodes.load());
+		}
+		fprintf(fp, "}%s\n", i+1 < SU_PROF_COUNT ? "," : "");
+	}
+	fprintf(fp, "  }\n");
+	fprintf(fp, "}\n");
+}
+
+// 終了時に計測値を出力する。環境変数 SU_PROFILE_OUT があればそのファイルに、なければ標準エラーに書く
+static void su_ProfileDumpAtExit() {
+	const char *name = getenv("SU_PROFILE_OUT");
+	FILE *fp = name ? fopen(name, "w") : NULL;
+	su_ProfileDump(fp ? fp : stderr);
+	if (fp) fclose(fp);
+}
+#endif
+
+#	define SU_PROF_SCOPE(id)     CSudokuProfScope su_prof_scope_(id)
+#	define SU_PROF_HIT(id)       su_Profile[id].hits.fetch_add(1, std::memory_order_relaxed)
+#	define SU_PROF_NODES(id, n)  su_Profile[id].nodes.fetch_add(n, std::memory_order_relaxed)
+#else
+// SU_PROFILE を定義しなければ計測コードは一切生成されない
+#	define SU_PROF_SCOPE(id)
+#	define SU_PROF_HIT(id)
+#	define SU_PROF_NODES(id, n)
+#endif
+
+// 問題の対称性
+enum SU_SYM_ {
+	SU_SYM_NONE = 0, // 対称性なし
+	SU_SYM_ROT180,   // 180度回転対称（点対称）
+	SU_SYM_ROT90,    // 90度回転対称
+	SU_SYM_MIRROR_X, // 左右対称
+	SU_SYM_MIRROR_Y, // 上下対称
+	SU_SYM_DIAG,     // 対角線対称
+	SU_SYM_COUNT
+};
+
+// 問題作成の条件
+struct SU_GENPARAM {
+	int clues;    // 目標のヒント数（残す数字の数）。0 なら消せるだけ消す
+	int symmetry; // SU_SYM_xxx
+	int level;    // 解くのに必要な手筋のレベル SU_LEVEL_xxx。0 なら問わない
+	int maxtries; // 正解パターンを作り直す最大回数
+};
+
+// 最小性（どのヒントを消しても唯一解でなくなる）の判定結果
+enum SU_MINIMAL_ {
+	SU_MINIMAL_YES = 0,     // 最小。どのヒントも消せない
+	SU_MINIMAL_NO,          // 消しても唯一解のままのヒントがある
+	SU_MINIMAL_NOT_UNIQUE,  // そもそも解が複数ある
+	SU_MINIMAL_NO_SOLUTION, // 解がない
+};
+
+// 問題作成の統計
+struct SU_GENSTAT {
+	int tries;       // 作った正解パターンの数
+	int solves;      // canSolve() を呼んだ回数
+	int rejectClues; // ヒント数が目標に届かないので捨てた数
+	int rejectLevel; // 難易度が目標に届かないので捨てた数
+	int skips;       // 回避不能集合のヒントがなくなるので、解いてみずに消すのをやめた数
+};
+
+// 乱数。状態はスレッドごとに別々なので、スレッドごとに su_SeedRand() で種を決めれば結果を再現できる
+// （rand() は環境によって全スレッドで状態を共有するので使わない）
+static std::mt19937 &su_RandEngine() {
+	static thread_local std::mt19937 engine;
+	return engine;
+}
+static void su_SeedRand(unsigned seed) {
+	su_RandEngine().seed(seed);
+}
+// 0 ～ 2^31-1 の乱数
+static int su_Rand() {
+	return (int)(su_RandEngine()() >> 1);
+}
+
 // １～９の範囲で、重複しない二つの数字を選ぶ
 static void su_GetRandomIntPair(int *outa, int *outb) {
 	int a, b;
 	do {
-		a = rand() % 9;
-		b = rand() % 9;
+		a = su_Rand() % 9;
+		b = su_Rand() % 9;
 	} while (a == b);
 	*outa = 1+a;
 	*outb = 1+b;
@@ -69,112 +273,1455 @@ static void su_GetRandomIntPair(int *outa, int *outb) {
 // 同じブロックにある二つの行を重複せずに選ぶ
 static void su_GetRandomLinePair(int *outa, int *outb) {
 	// ブロックを1つだけ選択
-	int block = rand() % 3;
+	int block = su_Rand() % 3;
 	
 	// そのブロックの中の行（列）を二つ選択
 	// ※３行のうちの２行を順不同で選ぶということは、無関係な１行を選ぶのと同じ（残りの２行が自動的に重複なしの行になる）なので
 	// 　別に while でやる必要もないのだが、なんとなく。
 	int la, lb;
 	do {
-		la = rand() % 3;
-		lb = rand() % 3;
+		la = su_Rand() % 3;
+		lb = su_Rand() % 3;
 	} while (la == lb);
 
-	*outa = block * 3 + la;
-	*outb = block * 3 + lb;
-}
+	*outa = block * 3 + la;
+	*outb = block * 3 + lb;
+}
+
+// １～９の数字の羅列からなる文字列 str を指定して、数字配列 result を得る
+static void su_ImportNumbers(int *result, const char *str) {
+	//
+	assert(result);
+	assert(str);
+	memset(result, 0, sizeof(int) * SU_SIZE);
+
+	int x = 0;
+	int y = 0;
+	bool wrapped = false; // 直前の文字で９マス分埋まり、自動的に次の行へ進んだ
+	for (const char *c=str; *c!='\0' && y<9; c++) {
+		if (*c == '\n') { // 改行があったら残りのマスをスキップして次の行へ
+			if (!wrapped) {
+				y++;
+				x = 0;
+			}
+			wrapped = false;
+			continue;
+		}
+		if (isdigit((unsigned char)*c)) { // 数字があったらその数字を入れる
+			int n = *c - '0';
+			if (1 <= n && n <= 9) {
+				result[su_IndexOf(x, y)] = n;
+			}
+		} // それ以外の文字だったら空白のままにする
+		x++;
+		wrapped = false;
+		if (x == 9) { // 改行がなくても９文字で次の行へ
+			y++;
+			x = 0;
+			wrapped = true;
+		}
+	}
+}
+static void su_Copy(int *dst, const int *src) {
+	memcpy(dst, src, sizeof(int) * SU_SIZE);
+}
+static void su_ZeroClear(int *dst) {
+	memset(dst, 0, sizeof(int) * SU_SIZE);
+}
+// 対称性 sym でマス index を１回移したときの移動先
+static int su_SymmetryImage(int sym, int index) {
+	int x = index % 9;
+	int y = index / 9;
+	switch (sym) {
+	case SU_SYM_ROT180:   return su_IndexOf(8-x, 8-y);
+	case SU_SYM_ROT90:    return su_IndexOf(8-y, x);
+	case SU_SYM_MIRROR_X: return su_IndexOf(8-x, y);
+	case SU_SYM_MIRROR_Y: return su_IndexOf(x, 8-y);
+	case SU_SYM_DIAG:     return su_IndexOf(y, x);
+	}
+	return index;
+}
+
+// 対称性 sym で互いに移り合うマスのグループ（軌道）を作る
+// orbits[k] に k 番目のグループのマス、sizes[k] にそのマス数（1～4）が入る。グループ数を返す
+static int su_GetSymmetryOrbits(int sym, int orbits[SU_SIZE][4], int *sizes) {
+	bool used[SU_SIZE] = {false};
+	int cnt = 0;
+	for (int i=0; i<SU_SIZE; i++) {
+		if (used[i]) continue;
+		int n = 0;
+		int j = i;
+		do {
+			used[j] = true;
+			orbits[cnt][n] = j;
+			n++;
+			j = su_SymmetryImage(sym, j);
+		} while (j != i && n < 4);
+		sizes[cnt] = n;
+		cnt++;
+	}
+	return cnt;
+}
+
+// 対称性 sym を保ったまま、ヒント数をちょうど clues 個にできる？（0 なら制限なしなので true）
+// ヒントは軌道単位で残るので、軌道の大きさの組み合わせで clues が作れるかどうかで決まる
+// 例えば 90度回転対称の軌道は 4 マスが 20 個と中央の 1 マスなので、ヒント数は 4 の倍数か、それに 1 を足したものだけ
+static bool su_CluesReachable(int sym, int clues) {
+	if (clues <= 0) return true;
+	if (clues > SU_SIZE) return false;
+	int orbits[SU_SIZE][4];
+	int sizes[SU_SIZE];
+	int numorbits = su_GetSymmetryOrbits(sym, orbits, sizes);
+	bool can[SU_SIZE+1] = {true}; // can[c]: いくつかの軌道でちょうど c マスにできる
+	for (int k=0; k<numorbits; k++) {
+		for (int c=SU_SIZE; c>=sizes[k]; c--) {
+			if (can[c - sizes[k]]) can[c] = true;
+		}
+	}
+	return can[clues];
+}
+
+// ---------------------------------------------------------------------------
+// 盤面の変換
+// 行・列の入れ替え、バンド（３行の組）・スタック（３列の組）の入れ替え、転置、数字の付け替えは
+// 正解パターンを正解パターンに移す。これらをいくつ重ねても「マスの並べ替え＋数字の付け替え」１回で表せるので、
+// 先に変換どうしを合成しておき、盤面には最後に１回だけ適用する
+// ---------------------------------------------------------------------------
+
+// 盤面の変換
+// 変換後の盤面のマス i には、変換前のマス cell[i] の数字 n を digit[n] に付け替えたものが入る
+struct SU_TRANSFORM {
+	int cell[SU_SIZE];
+	int digit[10]; // digit[0] は 0（空きマスは空きマスのまま）
+};
+
+// 何もしない変換
+static void su_IdentityTransform(SU_TRANSFORM *t) {
+	for (int i=0; i<SU_SIZE; i++) {
+		t->cell[i] = i;
+	}
+	for (int n=0; n<=9; n++) {
+		t->digit[n] = n;
+	}
+}
+
+// y0 と y1 にある行（横一列）を入れ替える変換
+static void su_RowSwapTransform(SU_TRANSFORM *t, int y0, int y1) {
+	su_IdentityTransform(t);
+	for (int x=0; x<9; x++) {
+		std::swap(t->cell[su_IndexOf(x, y0)], t->cell[su_IndexOf(x, y1)]);
+	}
+}
+
+// x0 と x1 にある列（縦一列）を入れ替える変換
+static void su_ColSwapTransform(SU_TRANSFORM *t, int x0, int x1) {
+	su_IdentityTransform(t);
+	for (int y=0; y<9; y++) {
+		std::swap(t->cell[su_IndexOf(x0, y)], t->cell[su_IndexOf(x1, y)]);
+	}
+}
+
+// 数字 n0 と n1 を入れ替える変換
+static void su_NumSwapTransform(SU_TRANSFORM *t, int n0, int n1) {
+	su_IdentityTransform(t);
+	std::swap(t->digit[n0], t->digit[n1]);
+}
+
+// a のあとに b を行う変換を out に入れる（out は a や b と同じでもよい）
+static void su_ComposeTransform(SU_TRANSFORM *out, const SU_TRANSFORM &a, const SU_TRANSFORM &b) {
+	SU_TRANSFORM r;
+	for (int i=0; i<SU_SIZE; i++) {
+		r.cell[i] = a.cell[b.cell[i]];
+	}
+	for (int n=0; n<=9; n++) {
+		r.digit[n] = b.digit[a.digit[n]];
+	}
+	*out = r;
+}
+
+// 0～8 を、３つずつの組を崩さずに並べる（組の順番と、組の中の順番をそれぞれ混ぜる）
+// 並べ方は 6*6*6*6 = 1296 通りあり、k（0～1295）でどれにするかを指定する
+static void su_GetLineOrder(int k, int *lines) {
+	static const int perm3[6][3] = {{0,1,2}, {0,2,1}, {1,0,2}, {1,2,0}, {2,0,1}, {2,1,0}};
+	const int *groups = perm3[k % 6];
+	k /= 6;
+	for (int g=0; g<3; g++) {
+		const int *inner = perm3[k % 6];
+		k /= 6;
+		for (int i=0; i<3; i++) {
+			lines[g*3+i] = groups[g]*3 + inner[i];
+		}
+	}
+}
+
+// 数独の対称群からランダムに選んだ変換を作る
+// geometry が false なら数字の付け替えだけにする（マスを動かすと成り立たなくなる変則ルール用）
+// 行・列の並べ方と数字の並べ方はそれぞれ１つの通し番号として引くので、乱数は５回しか引かない
+static void su_RandomTransform(SU_TRANSFORM *t, bool geometry) {
+	int rows[9], cols[9];
+	bool transpose = false;
+	if (geometry) {
+		su_GetLineOrder(su_Rand() % 1296, rows);
+		su_GetLineOrder(su_Rand() % 1296, cols);
+		transpose = su_Rand() % 2 != 0;
+	} else {
+		su_GetLineOrder(0, rows);
+		su_GetLineOrder(0, cols);
+	}
+	for (int y=0; y<9; y++) {
+		for (int x=0; x<9; x++) {
+			t->cell[su_IndexOf(x, y)] = transpose ? su_IndexOf(cols[y], rows[x]) : su_IndexOf(cols[x], rows[y]);
+		}
+	}
+	// 9! = 720 * 504 通りの並べ方の通し番号 k を、桁ごとに基数の違う数とみなして１桁ずつ取り出す
+	int k = (su_Rand() % 720) * 504 + su_Rand() % 504;
+	for (int n=0; n<=9; n++) {
+		t->digit[n] = n;
+	}
+	for (int n=9; n>1; n--) {
+		std::swap(t->digit[n], t->digit[1 + k % n]);
+		k /= n;
+	}
+}
+
+// 盤面 src に変換 t を適用して dst に入れる（src と dst は別の配列でないといけない）
+// AVX2 が使えるなら、マスの並べ替えと数字の付け替えを８マスずつギャザー命令で行う
+static void su_ApplyTransform(const SU_TRANSFORM &t, const int *src, int *dst) {
+	assert(src != dst);
+	int i = 0;
+#ifdef __AVX2__
+	for (; i+8<=SU_SIZE; i+=8) {
+		__m256i idx = _mm256_loadu_si256((const __m256i *)(t.cell + i));
+		__m256i v = _mm256_i32gather_epi32(src, idx, 4);
+		v = _mm256_i32gather_epi32(t.digit, v, 4);
+		_mm256_storeu_si256((__m256i *)(dst + i), v);
+	}
+#endif
+	for (; i<SU_SIZE; i++) {
+		dst[i] = t.digit[src[t.cell[i]]];
+	}
+}
+
+#ifndef SU_NO_MAIN // variants コマンドからしか使わない
+// 盤面 src に count 個の変換 t[0]～t[count-1] をそれぞれ適用し、dst に count 個の盤面（count*81 要素）を並べる
+static void su_ApplyTransforms(const SU_TRANSFORM *t, int count, const int *src, int *dst) {
+	for (int k=0; k<count; k++) {
+		su_ApplyTransform(t[k], src, dst + k * SU_SIZE);
+	}
+}
+#endif
+
+static void su_SetConsoleTextAttr(TEXTATTRS attr) {
+	// FOREGROUND_BLUE      0x0001 // text color contains blue.
+	// FOREGROUND_GREEN     0x0002 // text color contains green.
+	// FOREGROUND_RED       0x0004 // text color contains red.
+	// FOREGROUND_INTENSITY 0x0008 // text color is intensified.
+	WORD flag = 0;
+	switch (attr & 0x0F) {
+	case TEXTATTR_INIT:
+		flag |= FOREGROUND_GREEN|FOREGROUND_INTENSITY;
+		break;
+//	case TEXTATTR_CUR:
+//		flag |= FOREGROUND_RED|FOREGROUND_INTENSITY;
+//		break;
+	case TEXTATTR_GRAY:
+		flag |= FOREGROUND_INTENSITY;
+		break;
+	default:
+		flag |= FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED;
+		break;
+	}
+	switch (attr & 0xF0) {
+	case TEXTATTR_EQUL:
+		flag |= BACKGROUND_BLUE|BACKGROUND_INTENSITY;
+		break;
+	}
+
+	// 直前に置いたセル。他の属性よりも優先する
+	if (attr & TEXTATTR_CUR) {
+		flag = BACKGROUND_RED|BACKGROUND_INTENSITY|FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED|FOREGROUND_INTENSITY;
+	}
+
+	// エラー表示用（セルの表示には使わない）
+	if (attr & TEXTATTR_ERR) {
+		flag = FOREGROUND_RED|FOREGROUND_INTENSITY;
+	}
+
+	// メッセージ表示用（セルの表示には使わない）
+	if (attr & TEXTATTR_MSG) {
+		flag = BACKGROUND_GREEN|BACKGROUND_RED|BACKGROUND_INTENSITY;
+	}
+	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), flag);
+}
+
+
+
+// ---------------------------------------------------------------------------
+// ハウス（同じ数字が１つしか入らない９マスのグループ）の定義
+// 通常の数独は 行・列・ブロック の 27 個。変則ルールでは対角線や窓を追加したり、
+// ブロックの代わりに不定形の領域を使ったりする
+// ハウス番号 0～8 は行、9～17 は列、18～26 はブロック（または不定形の領域）で固定
+// ---------------------------------------------------------------------------
+static const int SU_MAX_HOUSES = 27 + 2 + 4;  // 行・列・ブロック + 対角線 + 窓
+static const int SU_MAX_CELL_HOUSES = 6;      // １マスが属するハウスの最大数
+static const int SU_MAX_PEERS = SU_SIZE - 1;  // １マスと同じハウスに属するマスの最大数
+
+enum SU_HOUSE_ {
+	SU_HOUSE_ROW,    // 横一列
+	SU_HOUSE_COL,    // 縦一列
+	SU_HOUSE_BLOCK,  // 3x3ブロック
+	SU_HOUSE_REGION, // 不定形の領域
+	SU_HOUSE_DIAG,   // 対角線
+	SU_HOUSE_WINDOW, // 窓
+};
+
+// ルールの種類（組み合わせ可）
+enum SU_RULEFLAG_ {
+	SU_RULE_CLASSIC = 0x00, // 通常の数独
+	SU_RULE_X       = 0x01, // 対角線にも同じ数字が入らない
+	SU_RULE_WINDOW  = 0x02, // ４つの窓にも同じ数字が入らない
+};
+
+struct SU_RULE {
+	int numhouses;
+	int house[SU_MAX_HOUSES][9];                  // ハウスに属するマス
+	int kind[SU_MAX_HOUSES];                      // SU_HOUSE_xxx
+	int numcellhouses[SU_SIZE];
+	int cellhouses[SU_SIZE][SU_MAX_CELL_HOUSES];  // マスが属するハウス
+	int numpeers[SU_SIZE];
+	int peers[SU_SIZE][SU_MAX_PEERS];             // マスと同じハウスに属するほかのマス
+	bool banded; // 列以外のハウスがすべて１つのバンドに収まっている（バンド単位のメモが使える）
+};
+
+// ルール rule を作る
+// regions には不定形の領域を 81 文字（各マスの領域番号 1～9）で指定する。NULL なら 3x3 ブロック
+// 領域の指定がおかしい場合は false を返す
+static bool su_InitRule(SU_RULE *rule, int flags, const char *regions) {
+	memset(rule, 0, sizeof(SU_RULE));
+	int n = 0;
+	for (int y=0; y<9; y++) {
+		for (int x=0; x<9; x++) {
+			rule->house[n][x] = su_IndexOf(x, y);
+		}
+		rule->kind[n++] = SU_HOUSE_ROW;
+	}
+	for (int x=0; x<9; x++) {
+		for (int y=0; y<9; y++) {
+			rule->house[n][y] = su_IndexOf(x, y);
+		}
+		rule->kind[n++] = SU_HOUSE_COL;
+	}
+	if (regions) {
+		int size[9] = {0};
+		for (int i=0; i<SU_SIZE; i++) {
+			int r = regions[i] - '1';
+			if (r < 0 || 9 <= r || size[r] >= 9) {
+				return false;
+			}
+			rule->house[n + r][size[r]++] = i;
+		}
+		for (int r=0; r<9; r++) {
+			rule->kind[n++] = SU_HOUSE_REGION;
+		}
+	} else {
+		for (int by=0; by<3; by++) {
+			for (int bx=0; bx<3; bx++) {
+				for (int k=0; k<9; k++) {
+					rule->house[n][k] = su_IndexOf(bx*3 + k%3, by*3 + k/3);
+				}
+				rule->kind[n++] = SU_HOUSE_BLOCK;
+			}
+		}
+	}
+	if (flags & SU_RULE_X) {
+		for (int k=0; k<9; k++) {
+			rule->house[n][k] = su_IndexOf(k, k);
+			rule->house[n+1][k] = su_IndexOf(8-k, k);
+		}
+		rule->kind[n++] = SU_HOUSE_DIAG;
+		rule->kind[n++] = SU_HOUSE_DIAG;
+	}
+	if (flags & SU_RULE_WINDOW) {
+		for (int wy=0; wy<2; wy++) {
+			for (int wx=0; wx<2; wx++) {
+				for (int k=0; k<9; k++) {
+					rule->house[n][k] = su_IndexOf(1 + wx*4 + k%3, 1 + wy*4 + k/3);
+				}
+				rule->kind[n++] = SU_HOUSE_WINDOW;
+			}
+		}
+	}
+	rule->numhouses = n;
+
+	// マスごとのハウスとピア
+	rule->banded = true;
+	for (int h=0; h<n; h++) {
+		for (int k=0; k<9; k++) {
+			int c = rule->house[h][k];
+			rule->cellhouses[c][rule->numcellhouses[c]++] = h;
+			if (rule->kind[h] != SU_HOUSE_COL && c / 27 != rule->house[h][0] / 27) {
+				rule->banded = false;
+			}
+		}
+	}
+	for (int c=0; c<SU_SIZE; c++) {
+		bool peer[SU_SIZE] = {false};
+		for (int k=0; k<rule->numcellhouses[c]; k++) {
+			const int *cells = rule->house[rule->cellhouses[c][k]];
+			for (int j=0; j<9; j++) {
+				peer[cells[j]] = true;
+			}
+		}
+		peer[c] = false;
+		for (int p=0; p<SU_SIZE; p++) {
+			if (peer[p]) {
+				rule->peers[c][rule->numpeers[c]++] = p;
+			}
+		}
+	}
+	return true;
+}
+
+// 通常の数独のルール
+static const SU_RULE *su_ClassicRule() {
+	static SU_RULE rule;
+	static bool init = su_InitRule(&rule, SU_RULE_CLASSIC, NULL);
+	(void)init;
+	return &rule;
+}
+
+// ---------------------------------------------------------------------------
+// Dancing Links による解の探索
+// 数独を 324 個の制約（各マスに数字が１つ、各行・各列・各ブロックに各数字が１つ）の
+// 完全被覆問題として扱い、すべての解を数えたり列挙したりする
+// ---------------------------------------------------------------------------
+// 探索の制限。どれかに達したら探索を打ち切る
+struct SU_LIMIT {
+	std::chrono::steady_clock::time_point deadline; // 締め切り時刻
+	unsigned long long maxnodes;                    // 探索ノード数の上限。0 なら制限なし
+	const std::atomic<bool> *cancel;                // true になったら打ち切る。NULL なら使わない
+
+	SU_LIMIT() {
+		deadline = std::chrono::steady_clock::time_point::max();
+		maxnodes = 0;
+		cancel = NULL;
+	}
+	// 今から msec ミリ秒後を締め切りにする
+	void setTimeout(long long msec) {
+		deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(msec);
+	}
+};
+
+// 探索の結果
+enum SU_SEARCH_ {
+	SU_SEARCH_DONE = 0, // 最後まで探索した
+	SU_SEARCH_TIMEOUT,  // 締め切りを過ぎたので打ち切った
+	SU_SEARCH_BUDGET,   // ノード数の上限に達したので打ち切った
+	SU_SEARCH_CANCELED, // キャンセルされたので打ち切った
+};
+struct SU_SEARCHRESULT {
+	int status;               // SU_SEARCH_xxx
+	unsigned long long nodes; // 探索したノード数
+	unsigned long long count; // 見つけた解の数（打ち切った場合はそこまでの数）
+};
+
+static const int SU_DLX_COLS = SU_SIZE + SU_MAX_HOUSES * 9; // 制約の最大数
+static const int SU_DLX_ROWS = SU_SIZE * 9;                 // 候補（マス, 数字）の数
+static const int SU_DLX_ROOT = SU_DLX_COLS;                 // ルートノード
+static const int SU_DLX_NODES = SU_DLX_COLS + 1 + SU_DLX_ROWS * (1 + SU_MAX_CELL_HOUSES);
+
+// 候補 row =（マス, 数字）を満たす制約の番号を得る。制約の数を返す
+// row = マス * 9 + (数字 - 1)
+// 制約はマスごとに１つ（0～80）と、ハウス h と数字 d の組ごとに１つ（81 + h * 9 + d）
+static int su_DLXColumnsOf(const SU_RULE *rule, int row, int *cols) {
+	int cell = row / 9;
+	int d = row % 9;
+	cols[0] = cell; // マスに数字が入る
+	for (int k=0; k<rule->numcellhouses[cell]; k++) {
+		cols[1+k] = SU_SIZE + rule->cellhouses[cell][k] * 9 + d; // ハウスに数字 d が入る
+	}
+	return 1 + rule->numcellhouses[cell];
+}
+
+// バンド（横に並んだ３ブロック）を埋め終わった時点の状態。
+// それより下のバンドの埋め方の数は、各列に既に使われている数字の組み合わせだけで決まる
+struct SU_DLXKEY {
+	unsigned long long lo; // 0～6 列目の使用済み数字 (9bit x 7)
+	unsigned long long hi; // 7～8 列目の使用済み数字 (9bit x 2) とバンド番号
+	bool operator == (const SU_DLXKEY &k) const {
+		return lo == k.lo && hi == k.hi;
+	}
+};
+struct SU_DLXKEYHASH {
+	size_t operator () (const SU_DLXKEY &k) const {
+		return (size_t)(k.lo * 0x9E3779B97F4A7C15ULL ^ k.hi);
+	}
+};
+
+// バンド単位のメモ。スレッド間で共有する
+class CSudokuBandMemo {
+	std::unordered_map<SU_DLXKEY, unsigned long long, SU_DLXKEYHASH> m_map;
+	std::mutex m_mutex;
+public:
+	bool find(const SU_DLXKEY &key, unsigned long long *val) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_map.find(key);
+		if (it == m_map.end()) return false;
+		*val = it->second;
+		return true;
+	}
+	void add(const SU_DLXKEY &key, unsigned long long val) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_map[key] = val;
+	}
+	size_t size() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_map.size();
+	}
+};
+
+// 9bit の数字の集合の要素数
+static int su_BitCount(int bits) {
+	int n = 0;
+	for (; bits; bits &= bits - 1) n++;
+	return n;
+}
+
+// 列ごとの数字の集合 m[9] を、スタックの中の列の入れ替えとスタックどうしの入れ替えで決まった形にそろえる
+// 通常の数独では、この入れ替えで下のバンドの埋め方の数は変わらない
+static void su_CanonicalColumns(int *m) {
+	for (int s=0; s<3; s++) {
+		std::sort(m + s*3, m + s*3 + 3);
+	}
+	// スタックを (列0, 列1, 列2) の辞書順に並べる
+	for (int i=1; i<3; i++) {
+		for (int j=i; j>0 && std::lexicographical_compare(m + j*3, m + j*3 + 3, m + (j-1)*3, m + (j-1)*3 + 3); j--) {
+			std::swap_ranges(m + j*3, m + j*3 + 3, m + (j-1)*3);
+		}
+	}
+}
+
+// 列ごとの数字の集合 m[9] とバンド番号をキーにまとめる
+static SU_DLXKEY su_ColumnsKey(const int *m, int band) {
+	SU_DLXKEY key;
+	key.lo = 0;
+	key.hi = (unsigned long long)band << 18;
+	for (int x=0; x<9; x++) {
+		if (x < 7) {
+			key.lo |= (unsigned long long)m[x] << (x * 9);
+		} else {
+			key.hi |= (unsigned long long)m[x] << ((x - 7) * 9);
+		}
+	}
+	return key;
+}
+
+// １つのバンド（３行）の埋め方の数（通常の数独のみ）。列 x には数字の集合 digits[x]（３個）を１つずつ入れる
+// スタックの３列で１～９を分け合っていなければブロックに重複が出るので 0。
+// あとは行に同じ数字が入らなければよいので、左の列から順に「各行で使った数字」を状態にして数える
+// 行を入れ替えても埋め方になるので、最初の列は小さい数字から上に入れたものだけ数えて 3! 倍する
+static unsigned long long su_CountBandFills(const int *digits) {
+	for (int s=0; s<3; s++) {
+		int a = digits[s*3], b = digits[s*3+1], c = digits[s*3+2];
+		if ((a | b | c) != SU_BIT_ALL || (a & b) || (a & c) || (b & c)) return 0;
+	}
+	static const int perms[6][3] = {{0,1,2}, {0,2,1}, {1,0,2}, {1,2,0}, {2,0,1}, {2,1,0}};
+	std::unordered_map<unsigned long long, unsigned long long> cur, next;
+	{
+		int d[3];
+		int n = 0;
+		for (int k=0; k<9; k++) {
+			if (digits[0] & (1 << k)) d[n++] = 1 << k;
+		}
+		cur[(unsigned long long)d[0] | (unsigned long long)d[1] << 9 | (unsigned long long)d[2] << 18] = 1;
+	}
+	for (int x=1; x<9; x++) {
+		int d[3];
+		int n = 0;
+		for (int k=0; k<9; k++) {
+			if (digits[x] & (1 << k)) d[n++] = 1 << k;
+		}
+		next.clear();
+		for (auto it=cur.begin(); it!=cur.end(); ++it) {
+			int rows[3] = {(int)(it->first & SU_BIT_ALL), (int)(it->first >> 9 & SU_BIT_ALL), (int)(it->first >> 18)};
+			for (int p=0; p<6; p++) {
+				int r0 = d[perms[p][0]], r1 = d[perms[p][1]], r2 = d[perms[p][2]];
+				if ((rows[0] & r0) || (rows[1] & r1) || (rows[2] & r2)) continue;
+				next[(unsigned long long)(rows[0] | r0) | (unsigned long long)(rows[1] | r1) << 9 | (unsigned long long)(rows[2] | r2) << 18] += it->second;
+			}
+		}
+		cur.swap(next);
+	}
+	unsigned long long total = 0;
+	for (auto it=cur.begin(); it!=cur.end(); ++it) {
+		total += it->second;
+	}
+	return total * 6;
+}
+
+// 一番上のバンドが埋まり、下の２つのバンドが空っぽのときの埋め方の数（通常の数独のみ）
+// free[x] は列 x の残りの数字（６個）。これを真ん中のバンドに入れる３個 T[x] と下のバンドに入れる残りに分けると、
+// 埋め方の数は Σ_T (真ん中のバンドの埋め方) × (下のバンドの埋め方) になる。
+// T はスタックごとに３列で１～９を分け合うものだけなので、真ん中のバンドを１マスずつ埋めていくよりずっと少ない
+// バンドの埋め方の数は上のバンドによらないので、memo があればバンド番号 3 のキーで共有する
+static unsigned long long su_CountTwoBands(const int *free, CSudokuBandMemo *memo) {
+	std::vector<int> splits[3]; // スタックごとの (T[0], T[1], T[2]) の候補を３つずつ並べたもの
+	for (int s=0; s<3; s++) {
+		const int *f = free + s*3;
+		for (int a=f[0]; a; a=(a-1)&f[0]) {
+			if (su_BitCount(a) != 3) continue;
+			for (int b=f[1]; b; b=(b-1)&f[1]) {
+				if (su_BitCount(b) != 3 || (a & b)) continue;
+				int c = SU_BIT_ALL & ~a & ~b;
+				if ((c & ~f[2]) == 0) {
+					splits[s].push_back(a);
+					splits[s].push_back(b);
+					splits[s].push_back(c);
+				}
+			}
+		}
+	}
+	// バンドの埋め方の数は列を並べ替えても変わらないので、並べ替えた形でメモする
+	CSudokuBandMemo local;
+	if (memo == NULL) memo = &local;
+	auto fills = [&](const int *digits) {
+		int m[9];
+		memcpy(m, digits, sizeof(m));
+		su_CanonicalColumns(m);
+		SU_DLXKEY key = su_ColumnsKey(m, 3);
+		unsigned long long n;
+		if (!memo->find(key, &n)) {
+			n = su_CountBandFills(m);
+			memo->add(key, n);
+		}
+		return n;
+	};
+	unsigned long long total = 0;
+	int t[9], rest[9];
+	for (size_t i0=0; i0<splits[0].size(); i0+=3) {
+		for (size_t i1=0; i1<splits[1].size(); i1+=3) {
+			for (size_t i2=0; i2<splits[2].size(); i2+=3) {
+				for (int k=0; k<3; k++) {
+					t[k] = splits[0][i0+k];
+					t[3+k] = splits[1][i1+k];
+					t[6+k] = splits[2][i2+k];
+				}
+				for (int x=0; x<9; x++) {
+					rest[x] = free[x] & ~t[x];
+				}
+				unsigned long long n = fills(t);
+				if (n > 0) {
+					total += n * fills(rest);
+				}
+			}
+		}
+	}
+	return total;
+}
+
+class CSudokuDLX {
+	int m_L[SU_DLX_NODES];
+	int m_R[SU_DLX_NODES];
+	int m_U[SU_DLX_NODES];
+	int m_D[SU_DLX_NODES];
+	int m_C[SU_DLX_NODES];   // ノードが属する制約
+	int m_row[SU_DLX_NODES]; // ノードが属する候補
+	int m_S[SU_DLX_COLS];    // 制約を満たす候補の残り数
+	int m_head[SU_DLX_ROWS]; // 候補の先頭ノード
+	bool m_covered[SU_DLX_COLS];
+	int m_stack[SU_SIZE];    // 選んだ候補
+	int m_depth;
+	bool m_ok;               // 最初から矛盾していない？
+	CSudokuBandMemo *m_memo;
+	unsigned long long m_nodes;
+	const SU_LIMIT *m_limit;
+	int m_status;            // SU_SEARCH_xxx
+	const SU_RULE *m_rule;
+	int m_fixedbands;        // 探索の前に数字を入れたり候補を取り除いたりしたマスのあるバンド（ビット）
+public:
+	// ルール rule の空っぽの盤面を作る
+	explicit CSudokuDLX(const SU_RULE *rule = su_ClassicRule()) {
+		m_rule = rule;
+		m_memo = NULL;
+		m_limit = NULL;
+		clear();
+	}
+
+	// ルールを設定する（盤面は空っぽになる）
+	void setRule(const SU_RULE *rule) {
+		m_rule = rule;
+		clear();
+	}
+
+	// 空っぽの盤面にする
+	void clear() {
+		int ncols = SU_SIZE + m_rule->numhouses * 9;
+		for (int c=0; c<ncols; c++) {
+			m_L[c] = c-1;
+			m_R[c] = c+1;
+			m_U[c] = c;
+			m_D[c] = c;
+			m_C[c] = c;
+			m_S[c] = 0;
+			m_covered[c] = false;
+		}
+		m_L[0] = SU_DLX_ROOT;
+		m_R[ncols-1] = SU_DLX_ROOT;
+		m_L[SU_DLX_ROOT] = ncols-1;
+		m_R[SU_DLX_ROOT] = 0;
+		int n = SU_DLX_ROOT + 1;
+		for (int r=0; r<SU_DLX_ROWS; r++) {
+			int cols[1 + SU_MAX_CELL_HOUSES];
+			int num = su_DLXColumnsOf(m_rule, r, cols);
+			m_head[r] = n;
+			for (int k=0; k<num; k++) {
+				int c = cols[k];
+				m_C[n] = c;
+				m_row[n] = r;
+				m_U[n] = m_U[c];
+				m_D[n] = c;
+				m_D[m_U[c]] = n;
+				m_U[c] = n;
+				m_L[n] = k==0 ? n+num-1 : n-1;
+				m_R[n] = k==num-1 ? n-num+1 : n+1;
+				m_S[c]++;
+				n++;
+			}
+		}
+		m_depth = 0;
+		m_ok = true;
+		m_nodes = 0;
+		m_status = SU_SEARCH_DONE;
+		m_fixedbands = 0;
+	}
+
+	// 盤面をロードする。num は 81 要素で、0 は空っぽのマス
+	// 数字が矛盾している場合は false を返す（解は 0 個になる）
+	bool load(const int *num) {
+		clear();
+		for (int i=0; i<SU_SIZE; i++) {
+			if (num[i] > 0) {
+				if (!place(i * 9 + num[i] - 1)) {
+					m_ok = false;
+				}
+			}
+		}
+		return m_ok;
+	}
+
+	// 候補 row を選ぶ。すでに満たされた制約とぶつかる場合は false
+	bool place(int row) {
+		int cols[1 + SU_MAX_CELL_HOUSES];
+		int num = su_DLXColumnsOf(m_rule, row, cols);
+		for (int k=0; k<num; k++) {
+			if (m_covered[cols[k]]) return false;
+		}
+		select(m_head[row]);
+		m_fixedbands |= 1 << (row / 9 / 27);
+		return true;
+	}
+
+	// 候補 row を取り除く（そのマスにその数字は入らないことにする）
+	// load() の直後に、まだ選べる候補に対してだけ使うこと
+	void exclude(int row) {
+		int n = m_head[row];
+		int j = n;
+		do {
+			if (m_covered[m_C[j]]) {
+				return; // すでに選べない候補
+			}
+			j = m_R[j];
+		} while (j != n);
+		j = n;
+		do {
+			m_U[m_D[j]] = m_U[j];
+			m_D[m_U[j]] = m_D[j];
+			m_S[m_C[j]]--;
+			j = m_R[j];
+		} while (j != n);
+		m_fixedbands |= 1 << (row / 9 / 27);
+	}
+
+	// 探索したノード数
+	unsigned long long getNodes() const {
+		return m_nodes;
+	}
+
+	// 探索の制限を設定する。NULL なら制限なし
+	void setLimit(const SU_LIMIT *limit) {
+		m_limit = limit;
+	}
+
+	// 直前の探索の結果 SU_SEARCH_xxx
+	int getStatus() const {
+		return m_status;
+	}
+
+	// 解の数を数える（limit 個に達したら打ち切る）
+	// memo を指定すると、バンドを埋め終わるたびに残りの解の数をメモして使い回す
+	unsigned long long count(unsigned long long limit, CSudokuBandMemo *memo=NULL) {
+		SU_PROF_SCOPE(SU_PROF_SEARCH);
+		if (!m_ok || limit == 0) return 0;
+		m_memo = m_rule->banded ? memo : NULL;
+		unsigned long long n = countRec(limit, currentBand());
+		m_memo = NULL;
+		return std::min(n, limit);
+	}
+
+	// 解を列挙する。解が見つかるたびに func(const int *num) を呼ぶ
+	// func が false を返したら打ち切る。列挙した解の数を返す
+	template <class FUNC> unsigned long long enumerate(FUNC func) {
+		SU_PROF_SCOPE(SU_PROF_SEARCH);
+		if (!m_ok) return 0;
+		unsigned long long n = 0;
+		enumRec(func, &n);
+		return n;
+	}
+
+	// 解を１つ、候補を試す順番をランダムにして探す。見つかれば num に入れて true を返す
+	// 同じ盤面からでも呼ぶたびに違う解が見つかる（乱数は su_Rand()）
+	bool findRandom(int *num) {
+		SU_PROF_SCOPE(SU_PROF_SEARCH);
+		if (!m_ok || !randRec()) return false;
+		getGrid(num);
+		return true;
+	}
+
+	// 一番上のバンドだけが埋まっていて、下の２つのバンドを探索せずに数えられる？
+	// そのときは探索木を分けると、かえって真ん中のバンドを１マスずつ埋めることになる
+	bool countsByBands() const {
+		return m_ok && currentBand() == 1 && onlyTopBandFilled();
+	}
+
+	// 探索木を上から広げて、独立に数えられる部分問題（選ぶ候補の列）に分ける
+	// 部分問題が mintasks 個以上になるか、これ以上分けられなくなったら終わる
+	// 下の２つのバンドを式で数えられる部分問題（countsByBands()）は分けない
+	// すでに解になっている部分問題の数を返す
+	unsigned long long split(int mintasks, std::vector<std::vector<int> > &tasks) const {
+		unsigned long long solved = 0;
+		tasks.clear();
+		tasks.push_back(std::vector<int>());
+		if (!m_ok) {
+			tasks.clear();
+			return 0;
+		}
+		while ((int)tasks.size() < mintasks) {
+			std::vector<std::vector<int> > next;
+			bool grown = false;
+			for (size_t t=0; t<tasks.size(); t++) {
+				CSudokuDLX *dlx = new CSudokuDLX(*this);
+				for (size_t k=0; k<tasks[t].size(); k++) {
+					dlx->select(dlx->m_head[tasks[t][k]]);
+				}
+				if (dlx->m_R[SU_DLX_ROOT] == SU_DLX_ROOT) {
+					solved++;
+				} else if (dlx->countsByBands()) {
+					next.push_back(tasks[t]); // これ以上分けずにそのまま数える
+				} else {
+					int c = dlx->chooseColumn(m_rule->banded ? dlx->currentBand() : 3);
+					for (int i=dlx->m_D[c]; i!=c; i=dlx->m_D[i]) {
+						std::vector<int> v = tasks[t];
+						v.push_back(dlx->m_row[i]);
+						next.push_back(v);
+					}
+					grown = true;
+				}
+				delete dlx;
+			}
+			tasks.swap(next);
+			if (!grown) break;
+		}
+		return solved;
+	}
+
+	// 部分問題 task の候補を選んだ状態にする
+	void apply(const std::vector<int> &task) {
+		for (size_t k=0; k<task.size(); k++) {
+			select(m_head[task[k]]);
+		}
+	}
+
+	// 現在選んでいる候補から盤面を作る
+	void getGrid(int *num) const {
+		su_ZeroClear(num);
+		for (int k=0; k<m_depth; k++) {
+			num[m_stack[k] / 9] = m_stack[k] % 9 + 1;
+		}
+	}
+
+private:
+	void cover(int c) {
+		m_covered[c] = true;
+		m_L[m_R[c]] = m_L[c];
+		m_R[m_L[c]] = m_R[c];
+		for (int i=m_D[c]; i!=c; i=m_D[i]) {
+			for (int j=m_R[i]; j!=i; j=m_R[j]) {
+				m_U[m_D[j]] = m_U[j];
+				m_D[m_U[j]] = m_D[j];
+				m_S[m_C[j]]--;
+			}
+		}
+	}
+	void uncover(int c) {
+		for (int i=m_U[c]; i!=c; i=m_U[i]) {
+			for (int j=m_L[i]; j!=i; j=m_L[j]) {
+				m_S[m_C[j]]++;
+				m_U[m_D[j]] = j;
+				m_D[m_U[j]] = j;
+			}
+		}
+		m_L[m_R[c]] = c;
+		m_R[m_L[c]] = c;
+		m_covered[c] = false;
+	}
+
+	// ノード n の候補を選ぶ
+	void select(int n) {
+		m_stack[m_depth++] = m_row[n];
+		cover(m_C[n]);
+		for (int j=m_R[n]; j!=n; j=m_R[j]) {
+			cover(m_C[j]);
+		}
+	}
+	// select() を取り消す
+	void unselect(int n) {
+		for (int j=m_L[n]; j!=n; j=m_L[j]) {
+			uncover(m_C[j]);
+		}
+		uncover(m_C[n]);
+		m_depth--;
+	}
+
+	// 空きマスが残っている一番上のバンド。すべて埋まっていれば 3
+	int currentBand() const {
+		int c = m_R[SU_DLX_ROOT];
+		if (c != SU_DLX_ROOT && c < SU_SIZE) {
+			return c / 27;
+		}
+		return 3;
+	}
+
+	// 次に調べる制約を選ぶ。候補が一番少ないもの
+	// band < 3 のときは、そのバンドのマスの制約だけから選ぶ（バンドを上から順に埋める）
+	// ただし候補が 0 個の制約があればそれを返す（行き止まり）
+	int chooseColumn(int band) const {
+		int best = -1;
+		int bestsize = SU_DLX_ROWS + 1;
+		int end = band < 3 ? (band + 1) * 27 : SU_DLX_COLS;
+		for (int c=m_R[SU_DLX_ROOT]; c!=SU_DLX_ROOT; c=m_R[c]) {
+			if (m_S[c] == 0) {
+				return c;
+			}
+			if (c < end && m_S[c] < bestsize) {
+				best = c;
+				bestsize = m_S[c];
+			}
+		}
+		return best;
+	}
+
+	// 列 x で使った数字の集合を m[x] に入れる
+	// 列 x のハウス番号は 9 + x なので、列と数字の制約は 81 + (9 + x) * 9 + d になる
+	void usedInColumns(int *m) const {
+		for (int x=0; x<9; x++) {
+			m[x] = 0;
+			for (int d=0; d<9; d++) {
+				if (m_covered[SU_SIZE + (9 + x) * 9 + d]) m[x] |= 1 << d;
+			}
+		}
+	}
+
+	// 通常の数独で、band から下に最初から入っている数字（や取り除いた候補）がない？
+	// そうなら下のバンドの埋め方の数は、列の入れ替え（スタックの中・スタックどうし）で変わらない
+	bool freeBelow(int band) const {
+		return m_rule->numhouses == 27 && m_rule->kind[18] == SU_HOUSE_BLOCK && (m_fixedbands >> band) == 0;
+	}
+
+	// バンド band の直前までを埋め終わった状態のキー
+	// 下が空っぽなら列を並べ替えた形をキーにする。そうしないと同じ埋め方の数になる状態がほとんど別のキーになり、メモが効かない
+	SU_DLXKEY bandKey(int band) const {
+		int m[9];
+		usedInColumns(m);
+		if (freeBelow(band)) {
+			su_CanonicalColumns(m);
+		}
+		return su_ColumnsKey(m, band);
+	}
+
+	// 一番上のバンドだけが埋まっていて、下の２つのバンドは空っぽ？（su_CountTwoBands() で数えられる）
+	bool onlyTopBandFilled() const {
+		if (!freeBelow(1)) return false;
+		for (int i=27; i<SU_SIZE; i++) {
+			if (m_covered[i]) return false;
+		}
+		return true;
+	}
+
+	// 探索の制限に達した？
+	// 時計とキャンセルは 1024 ノードごとに確かめる
+	bool expired() {
+		if (m_status != SU_SEARCH_DONE) {
+			return true;
+		}
+		if (m_limit == NULL) {
+			return false;
+		}
+		if (m_limit->maxnodes > 0 && m_nodes >= m_limit->maxnodes) {
+			m_status = SU_SEARCH_BUDGET;
+			return true;
+		}
+		if ((m_nodes & 1023) == 0) {
+			if (m_limit->cancel && m_limit->cancel->load(std::memory_order_relaxed)) {
+				m_status = SU_SEARCH_CANCELED;
+				return true;
+			}
+			if (std::chrono::steady_clock::now() >= m_limit->deadline) {
+				m_status = SU_SEARCH_TIMEOUT;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	unsigned long long countRec(unsigned long long limit, int prevband) {
+		if (expired()) {
+			return 0;
+		}
+		m_nodes++;
+		SU_PROF_NODES(SU_PROF_SEARCH, 1);
+		if (m_R[SU_DLX_ROOT] == SU_DLX_ROOT) {
+			return 1;
+		}
+		int band = currentBand();
+		bool memoize = m_memo && band != prevband && band > 0 && band < 3;
+		SU_DLXKEY key;
+		if (memoize) {
+			unsigned long long val;
+			key = bandKey(band);
+			if (m_memo->find(key, &val)) {
+				return val;
+			}
+		}
+		unsigned long long total = 0;
+		if (band == 1 && onlyTopBandFilled()) {
+			// 真ん中のバンドは空っぽなので、探索の途中から始めた部分問題でもメモを使える
+			key = bandKey(band);
+			if (m_memo && m_memo->find(key, &total)) {
+				return total;
+			}
+			int free[9];
+			usedInColumns(free);
+			for (int x=0; x<9; x++) {
+				free[x] = SU_BIT_ALL & ~free[x];
+			}
+			total = su_CountTwoBands(free, m_memo);
+			if (m_memo) {
+				m_memo->add(key, total);
+			}
+			return total;
+		}
+		int c = chooseColumn(m_memo ? band : 3);
+		if (c >= 0 && m_S[c] > 0) {
+			for (int i=m_D[c]; i!=c; i=m_D[i]) {
+				select(i);
+				total += countRec(limit - total, band);
+				unselect(i);
+				if (total >= limit || m_status != SU_SEARCH_DONE) {
+					return total; // 打ち切ったのでメモしない
+				}
+			}
+		}
+		if (memoize) {
+			m_memo->add(key, total);
+		}
+		return total;
+	}
+
+	template <class FUNC> bool enumRec(FUNC &func, unsigned long long *n) {
+		if (expired()) {
+			return false;
+		}
+		m_nodes++;
+		SU_PROF_NODES(SU_PROF_SEARCH, 1);
+		if (m_R[SU_DLX_ROOT] == SU_DLX_ROOT) {
+			int num[SU_SIZE];
+			getGrid(num);
+			(*n)++;
+			return func((const int *)num);
+		}
+		int c = chooseColumn(3);
+		if (m_S[c] == 0) {
+			return true;
+		}
+		for (int i=m_D[c]; i!=c; i=m_D[i]) {
+			select(i);
+			bool cont = enumRec(func, n);
+			unselect(i);
+			if (!cont) return false;
+		}
+		return true;
+	}
+
+	// 解が見つかったら、その候補を選んだまま true を返す
+	bool randRec() {
+		if (expired()) {
+			return false;
+		}
+		m_nodes++;
+		SU_PROF_NODES(SU_PROF_SEARCH, 1);
+		if (m_R[SU_DLX_ROOT] == SU_DLX_ROOT) {
+			return true;
+		}
+		int c = chooseColumn(3);
+		int order[9]; // １つの制約を満たす候補は９個まで
+		int num = 0;
+		for (int i=m_D[c]; i!=c; i=m_D[i]) {
+			order[num++] = i;
+		}
+		for (int k=num-1; k>0; k--) {
+			std::swap(order[k], order[su_Rand() % (k+1)]);
+		}
+		for (int k=0; k<num; k++) {
+			select(order[k]);
+			if (randRec()) return true;
+			unselect(order[k]);
+		}
+		return false;
+	}
+};
+
+// ルール rule で盤面 num の解の数を数える（limit 個で打ち切る）
+// threads > 1 なら探索木を部分問題に分けて並列に数える。バンド単位のメモはスレッド間で共有する
+static unsigned long long su_CountSolutions(const SU_RULE *rule, const int *num, unsigned long long limit, int threads) {
+	CSudokuBandMemo memo;
+	CSudokuDLX *root = new CSudokuDLX(rule);
+	root->load(num);
+	if (threads <= 1 || root->countsByBands()) {
+		unsigned long long n = root->count(limit, &memo);
+		delete root;
+		return n;
+	}
+	std::vector<std::vector<int> > tasks;
+	unsigned long long solved = root->split(threads * 16, tasks);
+	std::atomic<unsigned long long> total(solved);
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		CSudokuDLX *dlx = new CSudokuDLX(rule);
+		size_t t;
+		while ((t = next.fetch_add(1)) < tasks.size()) {
+			unsigned long long sofar = total.load();
+			if (sofar >= limit) break;
+			*dlx = *root;
+			dlx->apply(tasks[t]);
+			total.fetch_add(dlx->count(limit - sofar, &memo));
+		}
+		delete dlx;
+	};
+	std::vector<std::thread> pool;
+	for (int i=1; i<threads; i++) {
+		pool.push_back(std::thread(worker));
+	}
+	worker();
+	for (size_t i=0; i<pool.size(); i++) {
+		pool[i].join();
+	}
+	delete root;
+	return std::min(total.load(), limit);
+}
+
+
+// stepSolve() が試す手筋のまとまり。並びは対話用 stepSolve() が試す決まった順番
+enum SU_STEP_ {
+	SU_STEP_LAST_CELLS, // 空きマスが１つしかない行・列・ブロック (SU_LEVEL_EASY)
+	SU_STEP_LINE_UQS,   // 行・列の隠れシングル (SU_LEVEL_NORMAL)
+	SU_STEP_CELL_UQS,   // 裸のシングル (SU_LEVEL_HARD)
+	SU_STEP_BLOCK_UQS,  // ブロックなどの隠れシングル (SU_LEVEL_NORMAL)
+	SU_STEP_COUNT
+};
+
+static int su_StepLevel(int step) {
+	static const int levels[SU_STEP_COUNT] = {SU_LEVEL_EASY, SU_LEVEL_NORMAL, SU_LEVEL_HARD, SU_LEVEL_NORMAL};
+	assert(0 <= step && step < SU_STEP_COUNT);
+	return levels[step];
+}
+
+// 手筋を試す順番を、これまでの成績から決める
+// 手筋ごとに「試した回数・成功した回数・調べたマスの数」を記録し、
+// 「調べたマス数 / 成功回数」（数字を１つ確定させるのにかかる手間）の小さい順に並べ替える。
+// 手間は時間ではなくマスの数で数えるので、同じ問題を同じ順に解けば並びも必ず同じになる。
+// 成功したことのない手筋は後回しになるが、行き詰まったと判断する前には必ず試す。
+// シングル系の手筋はどの順で使っても最後にたどり着く盤面が同じなので、並びを変えても解ける・解けないは変わらない。
+// 1問ごとに作り直してもよいし、問題集全体で使い回してもよい（スレッドごとに１つ）
+class CSudokuScheduler {
+	int m_order[SU_STEP_COUNT];
+	unsigned long long m_tries[SU_STEP_COUNT];
+	unsigned long long m_hits[SU_STEP_COUNT];
+	unsigned long long m_cost[SU_STEP_COUNT];
+	bool m_adaptive;
+public:
+	// adaptive が false なら、常に SU_STEP_xxx の順番で試す
+	CSudokuScheduler(bool adaptive=true) {
+		reset(adaptive);
+	}
+
+	void reset(bool adaptive=true) {
+		m_adaptive = adaptive;
+		for (int i=0; i<SU_STEP_COUNT; i++) {
+			m_order[i] = i;
+			m_tries[i] = 0;
+			m_hits[i] = 0;
+			m_cost[i] = 0;
+		}
+	}
 
-// １～９の数字の羅列からなる文字列 str を指定して、数字配列 result を得る
-static void su_ImportNumbers(int *result, const char *str) {
-	//
-	assert(result);
-	assert(str);
-	memset(result, 0, sizeof(int) * SU_SIZE);
+	// k 番目に試す手筋 SU_STEP_xxx
+	int getOrder(int k) const {
+		assert(0 <= k && k < SU_STEP_COUNT);
+		return m_order[k];
+	}
+	unsigned long long getTries(int step) const { return m_tries[step]; }
+	unsigned long long getHits(int step) const { return m_hits[step]; }
+	unsigned long long getCost(int step) const { return m_cost[step]; }
 
-	int x = 0;
-	int y = 0;
-	for (const char *c=str; *c!='\0' && y<9; c++) {
-		if (*c == '\n') { // 改行があったら残りのマスをスキップして次の行へ
-			y++;
-			x = 0;
-			continue;
+	// 手筋 step を試した結果を記録する。cost は調べたマスの数
+	void record(int step, bool hit, unsigned long long cost) {
+		assert(0 <= step && step < SU_STEP_COUNT);
+		m_tries[step]++;
+		m_cost[step] += cost;
+		if (hit) m_hits[step]++;
+		if (m_adaptive) {
+			reorder();
 		}
-		if (x < 9) {
-			if (isdigit(*c)) { // 数字があったらその数字を入れる
-				int n = *c - '0';
-				if (1 <= n && n <= 9) {
-					result[su_IndexOf(x, y)] = n;
-				}
-				x++;
-			} else { // それ以外の文字だったら空白のままにする
-				x++;
+	}
+
+private:
+	// 数字１つあたりの手間。まだ成功していない手筋は、成功回数を 1 とみなした上で試した分だけ重くなる
+	double costPerHit(int step) const {
+		return (double)(m_cost[step] + 1) / (double)(m_hits[step] + 1);
+	}
+
+	// 手間の小さい順に並べ替える（同じなら SU_STEP_xxx の順）
+	void reorder() {
+		for (int i=1; i<SU_STEP_COUNT; i++) {
+			int s = m_order[i];
+			int j = i;
+			while (j > 0 && less(s, m_order[j-1])) {
+				m_order[j] = m_order[j-1];
+				j--;
 			}
+			m_order[j] = s;
 		}
 	}
+	bool less(int a, int b) const {
+		double ca = costPerHit(a);
+		double cb = costPerHit(b);
+		return ca < cb || (ca == cb && a < b);
+	}
+};
+
+// ---------------------------------------------------------------------------
+// 回避不能集合
+// 正解パターンのマスの集合 U で、U の数字だけを並べ替えても別の正解パターンになるもの。
+// 問題のヒントが U のマスを１つも含まなければ、その並べ替えも解になるので唯一解にならない。
+// つまり数字を消すときに、どれかの U のヒントがなくなってしまうなら、解いてみるまでもなく消せない
+// ---------------------------------------------------------------------------
+static const int SU_UNAVOIDABLE_MAXSIZE = 12; // 集める集合の最大のマス数
+
+// マスの集合（マス i をビット i で表す）
+struct SU_CELLMASK {
+	unsigned long long lo; // マス 0～63
+	unsigned long long hi; // マス 64～80
+};
+static void su_CellMaskAdd(SU_CELLMASK *m, int cell) {
+	if (cell < 64) m->lo |= 1ULL << cell; else m->hi |= 1ULL << (cell - 64);
 }
-static void su_Copy(int *dst, const int *src) {
-	memcpy(dst, src, sizeof(int) * SU_SIZE);
+static void su_CellMaskRemove(SU_CELLMASK *m, int cell) {
+	if (cell < 64) m->lo &= ~(1ULL << cell); else m->hi &= ~(1ULL << (cell - 64));
 }
-static void su_ZeroClear(int *dst) {
-	memset(dst, 0, sizeof(int) * SU_SIZE);
+static bool su_CellMaskHas(const SU_CELLMASK &m, int cell) {
+	return cell < 64 ? (m.lo >> cell) & 1 : (m.hi >> (cell - 64)) & 1;
 }
-static void su_SetConsoleTextAttr(TEXTATTRS attr) {
-	// FOREGROUND_BLUE      0x0001 // text color contains blue.
-	// FOREGROUND_GREEN     0x0002 // text color contains green.
-	// FOREGROUND_RED       0x0004 // text color contains red.
-	// FOREGROUND_INTENSITY 0x0008 // text color is intensified.
-	WORD flag = 0;
-	switch (attr & 0x0F) {
-	case TEXTATTR_INIT:
-		flag |= FOREGROUND_GREEN|FOREGROUND_INTENSITY;
-		break;
-//	case TEXTATTR_CUR:
-//		flag |= FOREGROUND_RED|FOREGROUND_INTENSITY;
-//		break;
-	case TEXTATTR_GRAY:
-		flag |= FOREGROUND_INTENSITY;
-		break;
-	default:
-		flag |= FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED;
-		break;
+static bool su_CellMaskIntersects(const SU_CELLMASK &a, const SU_CELLMASK &b) {
+	return (a.lo & b.lo) != 0 || (a.hi & b.hi) != 0;
+}
+// a は b に含まれる？
+static bool su_CellMaskSubset(const SU_CELLMASK &a, const SU_CELLMASK &b) {
+	return (a.lo & ~b.lo) == 0 && (a.hi & ~b.hi) == 0;
+}
+
+// 正解パターン１つ分の、小さな回避不能集合の一覧
+// 何種類かの数字を選び、それ以外の数字のマスを固定したまま、選んだ数字のマスを並べ替えて別の正解パターンを探す。
+// 元と違うマス（4～SU_UNAVOIDABLE_MAXSIZE 個）が回避不能集合になる。ほかの集合を含むものは捨てる
+class CSudokuUnavoidables {
+	std::vector<SU_CELLMASK> m_sets;     // 集合（マス数の少ない順）
+	std::vector<int> m_bycell[SU_SIZE];  // マスごとに、そのマスを含む集合の番号
+	// 以下は build() の作業用
+	const SU_RULE *m_rule;
+	const int *m_solution;
+	int m_cur[SU_SIZE];
+	int m_cells[SU_SIZE];
+	int m_numcells;
+	int m_used[SU_MAX_HOUSES];
+	std::vector<std::pair<int, SU_CELLMASK> > m_found; // (マス数, 集合)
+public:
+	CSudokuUnavoidables() {
+		m_rule = NULL;
+		m_solution = NULL;
+		m_numcells = 0;
 	}
-	switch (attr & 0xF0) {
-	case TEXTATTR_EQUL:
-		flag |= BACKGROUND_BLUE|BACKGROUND_INTENSITY;
-		break;
+
+	// 正解パターン solution の回避不能集合を集める
+	// solution に空きマスがあれば集合は作らない（wouldEmpty() は常に false になる）
+	// maxdigits は並べ替える数字の種類の最大数。２種類なら 36 通りを 0.1 ミリ秒ほどで調べられるが、
+	// ３種類まで広げると集合は増えるものの数十倍の時間がかかる
+	void build(const SU_RULE *rule, const int *solution, int maxdigits=2) {
+		m_sets.clear();
+		for (int i=0; i<SU_SIZE; i++) {
+			m_bycell[i].clear();
+		}
+		for (int i=0; i<SU_SIZE; i++) {
+			if (solution[i] < 1 || 9 < solution[i]) return;
+		}
+		m_rule = rule;
+		m_solution = solution;
+		m_found.clear();
+		for (int digits=1; digits<=SU_BIT_ALL; digits++) {
+			int num = 0;
+			for (int n=1; n<=9; n++) {
+				if (digits & su_Bit(n)) num++;
+			}
+			if (num < 2 || maxdigits < num) continue;
+			m_numcells = 0;
+			for (int i=0; i<SU_SIZE; i++) {
+				if (digits & su_Bit(solution[i])) m_cells[m_numcells++] = i;
+			}
+			memset(m_used, 0, sizeof(m_used));
+			su_Copy(m_cur, solution);
+			findRec(digits, 0, 0);
+		}
+		// 小さい順に並べ、すでに採用した集合を含むもの（同じものも）は捨てる
+		std::stable_sort(m_found.begin(), m_found.end(), [](const std::pair<int, SU_CELLMASK> &a, const std::pair<int, SU_CELLMASK> &b) {
+			return a.first < b.first;
+		});
+		for (size_t k=0; k<m_found.size(); k++) {
+			const SU_CELLMASK &u = m_found[k].second;
+			bool minimal = true;
+			for (size_t j=0; j<m_sets.size() && minimal; j++) {
+				if (su_CellMaskSubset(m_sets[j], u)) minimal = false;
+			}
+			if (!minimal) continue;
+			int idx = (int)m_sets.size();
+			m_sets.push_back(u);
+			for (int i=0; i<SU_SIZE; i++) {
+				if (su_CellMaskHas(u, i)) m_bycell[i].push_back(idx);
+			}
+		}
+		m_found.clear();
+		m_solution = NULL;
 	}
 
-	// 直前に置いたセル。他の属性よりも優先する
-	if (attr & TEXTATTR_CUR) {
-		flag = BACKGROUND_RED|BACKGROUND_INTENSITY|FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED|FOREGROUND_INTENSITY;
+	// 集合の数
+	int getCount() const {
+		return (int)m_sets.size();
 	}
 
-	// エラー表示用（セルの表示には使わない）
-	if (attr & TEXTATTR_ERR) {
-		flag = FOREGROUND_RED|FOREGROUND_INTENSITY;
+	// k 番目の集合
+	const SU_CELLMASK &getSet(int k) const {
+		return m_sets[k];
 	}
 
-	// メッセージ表示用（セルの表示には使わない）
-	if (attr & TEXTATTR_MSG) {
-		flag = BACKGROUND_GREEN|BACKGROUND_RED|BACKGROUND_INTENSITY;
+	// ヒントのマス clues から cells[0]～cells[numcells-1] を消すと、ヒントが１つも残らない集合ができる？
+	// true なら、消した盤面は唯一解にならない（clues は今のところすべての集合にヒントを持っているものとする）
+	bool wouldEmpty(const SU_CELLMASK &clues, const int *cells, int numcells) const {
+		SU_CELLMASK rest = clues;
+		for (int i=0; i<numcells; i++) {
+			su_CellMaskRemove(&rest, cells[i]);
+		}
+		for (int i=0; i<numcells; i++) {
+			const std::vector<int> &sets = m_bycell[cells[i]];
+			for (size_t k=0; k<sets.size(); k++) {
+				if (!su_CellMaskIntersects(m_sets[sets[k]], rest)) return true;
+			}
+		}
+		return false;
 	}
-	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), flag);
-}
 
+private:
+	// m_cells[k] 以降に digits の数字を入れ直す。diff はここまでで元と違うマスの数
+	void findRec(int digits, int k, int diff) {
+		if (k == m_numcells) {
+			if (diff == 0) return; // 元の正解パターンそのもの
+			SU_CELLMASK u = {0, 0};
+			for (int j=0; j<m_numcells; j++) {
+				int c = m_cells[j];
+				if (m_cur[c] != m_solution[c]) su_CellMaskAdd(&u, c);
+			}
+			m_found.push_back(std::make_pair(diff, u));
+			return;
+		}
+		int cell = m_cells[k];
+		const int *houses = m_rule->cellhouses[cell];
+		int numhouses = m_rule->numcellhouses[cell];
+		int free = digits;
+		for (int j=0; j<numhouses; j++) {
+			free &= ~m_used[houses[j]];
+		}
+		for (int n=1; n<=9; n++) {
+			int bit = su_Bit(n);
+			if ((free & bit) == 0) continue;
+			int d = diff + (n != m_solution[cell] ? 1 : 0);
+			if (d > SU_UNAVOIDABLE_MAXSIZE) continue; // これ以上違うマスが増えても小さな集合にならない
+			for (int j=0; j<numhouses; j++) m_used[houses[j]] |= bit;
+			m_cur[cell] = n;
+			findRec(digits, k+1, d);
+			for (int j=0; j<numhouses; j++) m_used[houses[j]] &= ~bit;
+		}
+		m_cur[cell] = m_solution[cell];
+	}
+};
 
+// 対話で１つずつ数字を消すときに使う回避不能集合の索引（スレッドごとに１つ）
+// 正解パターンが前回と同じなら、解き直しも索引の作り直しもしない
+struct SU_UNAVOIDABLECACHE {
+	const SU_RULE *rule;
+	int solution[SU_SIZE];
+	bool valid;
+	CSudokuUnavoidables sets;
+	SU_UNAVOIDABLECACHE() {
+		rule = NULL;
+		valid = false;
+	}
+};
 
 class CSudokuGrid {
 	int m_num[SU_SIZE];
 	int m_attr[SU_SIZE];
 	int m_hint[SU_SIZE];
+	const SU_RULE *m_rule; // ハウスの定義
+	int m_count[SU_MAX_HOUSES][10]; // ハウスごとの、各数字の個数
+	int m_filled;        // 数字が入っているマスの数
+	int m_conflicts;     // 同じ数字が２つ以上入っている（ハウス, 数字）の組の数。ハウスは今のルールのもの（行・列・ブロック、対角線など）
 	int m_lastx;
 	int m_lasty;
+	int m_lasttech;
+	unsigned long long m_scanned; // 手筋が調べたマスの数（CSudokuScheduler に渡す手間）
 	char m_lastmsg[256];
 public:
 	CSudokuGrid() {
+		m_rule = su_ClassicRule();
+		clear();
+	}
+
+	// ルール（ハウスの定義）を設定する。盤面は空っぽになる
+	void setRule(const SU_RULE *rule) {
+		m_rule = rule;
 		clear();
 	}
 
+	const SU_RULE *getRule() const {
+		return m_rule;
+	}
+
 	// 指定マスに入っている数字を得る
 	// まだ数字が入っていない場合は 0 を返す
 	int get(int x, int y) const {
@@ -185,32 +1732,35 @@ public:
 
 	// 指定マスに数字を入れる（このマスに入る数字が確定した）
 	void set(int x, int y, int num) {
+		SU_PROF_SCOPE(SU_PROF_SET);
 		assert(0 <= x && x < 9);
 		assert(0 <= y && y < 9);
 		assert(0 <= num && num <= 9);
+		int old = m_num[su_IndexOf(x, y)];
+		if (old > 0) {
+			countNum(x, y, old, -1);
+		}
 		m_num[su_IndexOf(x, y)] = num;
 
+		// 最後に変更したマスを記録しておく（画面上で強調表示するため）。数字を消したときも同じ
+		m_lastx = x;
+		m_lasty = y;
+		if (num == 0) {
+			// 数字を消した。ほかのマスのヒントは元に戻らないので注意
+			return;
+		}
+		countNum(x, y, num, 1);
+
 		// 数字が確定したので、このマスのヒントを消す
 		setHintZero(x, y);
 
-		// 同じ列、同じ行にあるある他のマスに num が入らないことが確定した
-		for (int i=0; i<9; i++) {
-			removeHint(i, y, num); // 横１列分のマスのヒントから num を消す
-			removeHint(x, i, num); // 縦１列分のマスのヒントから num を消す
-		}
-
-		// 同じ3x3ブロックにある他のマスに num が入らないことが確定した
-		int subx = (x / 3) * 3;
-		int suby = (y / 3) * 3;
-		for (int j=suby; j<suby+3; j++) {
-			for (int i=subx; i<subx+3; i++) {
-				removeHint(i, j, num); // 3x3ブロック内のマスのヒントから num を消す
-			}
+		// 同じ行・列・ブロック（ルールによっては対角線なども）にある他のマスに num が入らないことが確定した
+		int cell = su_IndexOf(x, y);
+		int bit = su_Bit(num);
+		const int *peers = m_rule->peers[cell];
+		for (int k=m_rule->numpeers[cell]-1; k>=0; k--) {
+			m_hint[peers[k]] &= ~bit;
 		}
-
-		// 最後に確定したマスを記録しておく（画面上で強調表示するため）
-		m_lastx = x;
-		m_lasty = y;
 	}
 
 	// 指定マスのヒント（このマスに入るべき数字の候補）をリセットする
@@ -257,8 +1807,13 @@ public:
 	void clear() {
 		m_lastx = -1;
 		m_lasty = -1;
+		m_lasttech = SU_TECH_NONE;
+		m_scanned = 0;
 		su_ZeroClear(m_num);
 		su_ZeroClear(m_attr);
+		memset(m_count, 0, sizeof(m_count));
+		m_filled = 0;
+		m_conflicts = 0;
 		for (int y=0; y<9; y++) {
 			for (int x=0; x<9; x++) {
 				setHintAll(x, y);
@@ -306,212 +1861,561 @@ public:
 		m_lasty = -1;
 	}
 
-	// 指定マスの数字をプリント
-	void printNum(int x, int y) const {
-		int lastn = 0;
-		if (m_lastx >= 0 && m_lasty >= 0) {
-			lastn = get(m_lastx, m_lasty);
-		}
+	// 盤面を 81 要素の配列にする（空っぽのマスは 0）
+	void saveToArray(int *num) const {
+		su_Copy(num, m_num);
+	}
+
+	// 盤面を 81 文字の文字列にする（空っぽのマスは '.'）
+	// out には 81+1 文字以上の領域が必要
+	void saveToString(char *out) const {
+		for (int i=0; i<SU_SIZE; i++) {
+			out[i] = m_num[i] > 0 ? (char)('0' + m_num[i]) : '.';
+		}
+		out[SU_SIZE] = '\0';
+	}
+
+	// 数字の入っているマスの数
+	int getClueCount() const {
+		return m_filled;
+	}
+
+	// 最後に stepSolve() が使った手筋 SU_TECH_xxx
+	int getLastTech() const {
+		return m_lasttech;
+	}
+
+	// 指定マスの数字をプリント
+	void printNum(int x, int y) const {
+		int lastn = 0;
+		if (m_lastx >= 0 && m_lasty >= 0) {
+			lastn = get(m_lastx, m_lasty);
+		}
+
+		int n = get(x, y);
+		if (n > 0) {
+			int attr = 0;
+			if (n == lastn) {
+				attr |= TEXTATTR_EQUL;
+			}
+			if (m_attr[su_IndexOf(x, y)] == TEXTATTR_INIT) {
+				attr |= TEXTATTR_INIT;
+			} else if (x==m_lastx && y==m_lasty) {
+				attr |= TEXTATTR_CUR;
+			}
+			su_SetConsoleTextAttr(attr);
+			printf("%d", n);
+			su_SetConsoleTextAttr(TEXTATTR_NONE);
+
+		} else {
+			putchar(' ');
+		}
+	}
+
+	// 数字の並びをプリント
+	void print() const {
+		#define N(x, y) printNum(x, y)
+		#define SEP  putchar('|')
+		#define CR  putchar('\n')
+		printf("+---+---+---+\n");
+		SEP, N(0,0), N(1,0), N(2,0), SEP, N(3,0), N(4,0), N(5,0), SEP, N(6,0), N(7,0), N(8,0); SEP; CR;
+		SEP, N(0,1), N(1,1), N(2,1), SEP, N(3,1), N(4,1), N(5,1), SEP, N(6,1), N(7,1), N(8,1); SEP; CR;
+		SEP, N(0,2), N(1,2), N(2,2), SEP, N(3,2), N(4,2), N(5,2), SEP, N(6,2), N(7,2), N(8,2); SEP; CR;
+		printf("+---+---+---+\n");
+		SEP, N(0,3), N(1,3), N(2,3), SEP, N(3,3), N(4,3), N(5,3), SEP, N(6,3), N(7,3), N(8,3); SEP; CR;
+		SEP, N(0,4), N(1,4), N(2,4), SEP, N(3,4), N(4,4), N(5,4), SEP, N(6,4), N(7,4), N(8,4); SEP; CR;
+		SEP, N(0,5), N(1,5), N(2,5), SEP, N(3,5), N(4,5), N(5,5), SEP, N(6,5), N(7,5), N(8,5); SEP; CR;
+		printf("+---+---+---+\n");
+		SEP, N(0,6), N(1,6), N(2,6), SEP, N(3,6), N(4,6), N(5,6), SEP, N(6,6), N(7,6), N(8,6); SEP; CR;
+		SEP, N(0,7), N(1,7), N(2,7), SEP, N(3,7), N(4,7), N(5,7), SEP, N(6,7), N(7,7), N(8,7); SEP; CR;
+		SEP, N(0,8), N(1,8), N(2,8), SEP, N(3,8), N(4,8), N(5,8), SEP, N(6,8), N(7,8), N(8,8); SEP; CR;
+		printf("+---+---+---+\n");
+		#undef CR
+		#undef SEP
+		#undef N
+		if (m_lastmsg[0]) {
+			printf("【赤いマスに注目してください】\n");
+			printf("%s\n", m_lastmsg);
+		}
+	}
+
+	// 問題解決の手順を１段階だけ進める
+	// maxlevel には使ってよい手筋の難しさ SU_LEVEL_xxx を指定する
+	bool stepSolve(int maxlevel=SU_LEVEL_MAX) {
+		SU_PROF_SCOPE(SU_PROF_STEPSOLVE);
+		if (step_any(maxlevel)) {
+			SU_PROF_HIT(SU_PROF_STEPSOLVE);
+			return true;
+		}
+		return false;
+	}
+
+	// 問題解決の手順を１段階だけ進める（手筋を試す順番は sched が決める）
+	// 対話用の stepSolve() と違って、確定させるマスや説明が決まった順番どおりになるとは限らない
+	bool stepSolve(int maxlevel, CSudokuScheduler &sched) {
+		SU_PROF_SCOPE(SU_PROF_STEPSOLVE);
+		if (step_scheduled(sched, maxlevel)) {
+			SU_PROF_HIT(SU_PROF_STEPSOLVE);
+			return true;
+		}
+		return false;
+	}
+
+	// どこかダメな点があるか？（同じ行・列・ブロックに同じ数字が２つ以上ある）
+	// set() が更新している個数を見るだけなので、盤面を調べ直したりはしない
+	bool hasError() const {
+		return m_conflicts > 0;
+	}
+
+	// 完成した？（全てのマスに数字が入っていて、重複がない）
+	// 何も表示しない。重複の報告が必要なら呼び出し側で hasError() を見ること
+	bool isSolved() const {
+		return m_filled == SU_SIZE && m_conflicts == 0;
+	}
+
+	// 正解条件を満たしている盤面をランダムに作成する（すべてのマスに数字が埋まっている状態）
+	// 空っぽの盤面から候補をランダムな順番で試して解を１つ探すので、どの正解パターンも出てくる
+	// （決まった盤面を shuffle() で崩すだけでは、行・列・数字の入れ替えで移り合うものしか作れない）
+	// ルールに解が１つもなければ false を返す（盤面は空っぽになる）
+	bool make() {
+		int num[SU_SIZE];
+		CSudokuDLX *dlx = new CSudokuDLX(m_rule);
+		bool found = dlx->findRandom(num);
+		delete dlx;
+		if (!found) {
+			clear();
+			return false;
+		}
+		loadFromArray(num);
+		assert(isSolved());
+		return true;
+	}
+
+	// 問題を解くことができる？
+	// maxlevel には使ってよい手筋の難しさ SU_LEVEL_xxx を指定する
+	// sched を指定すると手筋の成績をそこに蓄積し、次の呼び出しでも使う（NULL ならこの問題の中だけで学習する）
+	bool canSolve(int maxlevel=SU_LEVEL_MAX, CSudokuScheduler *sched=NULL) {
+		SU_PROF_SCOPE(SU_PROF_CANSOLVE);
+		CSudokuScheduler local;
+		if (sched == NULL) sched = &local;
+		CSudokuGrid grid;
+		grid.setRule(m_rule);
+		grid.loadFromArray(m_num);
+		while (grid.stepSolve(maxlevel, *sched)) {
+			SU_PROF_NODES(SU_PROF_CANSOLVE, 1);
+		}
+		if (grid.isSolved()) {
+			SU_PROF_HIT(SU_PROF_CANSOLVE);
+			return true;
+		}
+		return false;
+	}
+
+	// 簡単な手筋から順に試して数字を１つ確定させる
+	// 使った手筋のレベル SU_LEVEL_xxx を返す。どの手筋でも確定できなければ SU_LEVEL_NONE を返す
+	int stepSolveEasiest() {
+		SU_PROF_SCOPE(SU_PROF_STEPSOLVE);
+		for (int level=SU_LEVEL_EASY; level<=SU_LEVEL_MAX; level++) {
+			if (step_level(level)) {
+				SU_PROF_HIT(SU_PROF_STEPSOLVE);
+				return level;
+			}
+		}
+		return SU_LEVEL_NONE;
+	}
+
+	// 問題の難易度を判定する（盤面は解いた状態になる）
+	// 毎回いちばん簡単な手筋で数字を確定させていき、使った中でいちばん難しい手筋のレベルを返す。
+	// 途中で行き詰まるか、同じ数字が重複した時点で打ち切り、SU_LEVEL_NONE を返す
+	// steps には確定させた数字の数が入る
+	// どのマスから確定させるかで使う手筋が変わるので、手筋を試す順番はいつも同じにしておく（CSudokuScheduler は使わない）
+	int grade(int *steps) {
+		int level = SU_LEVEL_NONE;
+		int cnt = 0;
+		if (!hasError()) {
+			int lv;
+			while (!hasError() && (lv = stepSolveEasiest()) != SU_LEVEL_NONE) {
+				level = std::max(level, lv);
+				cnt++;
+			}
+			if (hasError() || !isSolved()) {
+				level = SU_LEVEL_NONE; // 行き詰まった、または矛盾した
+			}
+		}
+		if (steps) *steps = cnt;
+		return level;
+	}
+
+	// 解の数を数える（limit 個に達したら打ち切る）
+	// threads > 1 なら複数のスレッドで数える
+	unsigned long long countSolutions(unsigned long long limit, int threads=1) const {
+		return su_CountSolutions(m_rule, m_num, limit, threads);
+	}
+
+	// 制限つきで解の数を数える（maxcount 個に達したら打ち切る）
+	// 制限に達したら result->status にその理由が入り、result->count はそこまでに見つけた数になる
+	unsigned long long countSolutions(unsigned long long maxcount, const SU_LIMIT &limit, SU_SEARCHRESULT *result) const {
+		CSudokuDLX *dlx = new CSudokuDLX(m_rule);
+		dlx->load(m_num);
+		dlx->setLimit(&limit);
+		unsigned long long n = dlx->count(maxcount);
+		result->status = dlx->getStatus();
+		result->nodes = dlx->getNodes();
+		result->count = n;
+		delete dlx;
+		return n;
+	}
+
+	// 問題が最小か（どのヒントを消しても唯一解でなくなるか）を調べる
+	// 消しても唯一解のままのヒントのマス番号を redundant に入れ、その数を *numredundant に入れる
+	// stopAtFirst なら、そのようなヒントが１つ見つかった時点で打ち切る
+	// すべてのヒントの判定で次のものを共有する
+	//   - 解答 S は最初に１回だけ求める
+	//   - ヒント c を消した盤面に別解があるかは「c に S と違う数字が入る解」を１つ探せば分かる（解を２つ数えなくてよい）
+	//   - c を消しても stepSolve() だけで解けるなら、探索するまでもなく唯一解のまま
+	//   - S の回避不能集合にヒントが c しかないものがあれば、c を消すと唯一解でなくなる
+	int checkMinimal(int *redundant, int *numredundant, bool stopAtFirst=false) const {
+		*numredundant = 0;
+		int answer[SU_SIZE];
+		unsigned long long n = 0;
+		{
+			CSudokuDLX *dlx = new CSudokuDLX(m_rule);
+			dlx->load(m_num);
+			n = dlx->enumerate([&](const int *num) {
+				if (n == 0) su_Copy(answer, num);
+				return ++n < 2;
+			});
+			delete dlx;
+		}
+		if (n == 0) return SU_MINIMAL_NO_SOLUTION;
+		if (n > 1) return SU_MINIMAL_NOT_UNIQUE;
+
+		CSudokuUnavoidables unavoidables;
+		unavoidables.build(m_rule, answer);
+		SU_CELLMASK cluemask = {0, 0};
+		for (int c=0; c<SU_SIZE; c++) {
+			if (m_num[c] > 0) su_CellMaskAdd(&cluemask, c);
+		}
+
+		CSudokuDLX *dlx = new CSudokuDLX(m_rule);
+		CSudokuScheduler sched;
+		int tmp[SU_SIZE];
+		su_Copy(tmp, m_num);
+		for (int c=0; c<SU_SIZE; c++) {
+			if (m_num[c] == 0) continue;
+			if (unavoidables.wouldEmpty(cluemask, &c, 1)) continue;
+			tmp[c] = 0;
+			bool unique;
+			CSudokuGrid grid;
+			grid.setRule(m_rule);
+			grid.loadFromArray(tmp);
+			if (grid.canSolve(SU_LEVEL_MAX, &sched)) {
+				unique = true;
+			} else {
+				// c に S と違う数字が入る解はある？
+				dlx->load(tmp);
+				dlx->exclude(c * 9 + answer[c] - 1);
+				unique = dlx->enumerate([](const int *) { return false; }) == 0;
+			}
+			tmp[c] = m_num[c];
+			if (unique) {
+				redundant[(*numredundant)++] = c;
+				if (stopAtFirst) break;
+			}
+		}
+		delete dlx;
+		return *numredundant > 0 ? SU_MINIMAL_NO : SU_MINIMAL_YES;
+	}
+
+	// 制限つきで問題を解く
+	// まず stepSolve() で確定できるところまで埋め、残りを探索する。解けたら盤面は解答になる。
+	// 制限に達した場合は false を返し、盤面は stepSolve() で確定させたところまでの状態になる。
+	// 解がない場合も false を返す（result->status は SU_SEARCH_DONE, result->count は 0）
+	// stepSolve() で数字を１つ確定させるのも１ノードと数える
+	bool solve(const SU_LIMIT &limit, SU_SEARCHRESULT *result) {
+		result->status = SU_SEARCH_DONE;
+		result->nodes = 0;
+		result->count = 0;
+		// 数字を１つ確定させるごとに１ノードと数え、探索と同じ制限をかける
+		CSudokuScheduler sched;
+		while (!isSolved() && !hasError()) {
+			if (limit.cancel && limit.cancel->load(std::memory_order_relaxed)) {
+				result->status = SU_SEARCH_CANCELED;
+				return false;
+			}
+			if (limit.maxnodes > 0 && result->nodes >= limit.maxnodes) {
+				result->status = SU_SEARCH_BUDGET;
+				return false;
+			}
+			if (std::chrono::steady_clock::now() >= limit.deadline) {
+				result->status = SU_SEARCH_TIMEOUT;
+				return false;
+			}
+			if (!stepSolve(SU_LEVEL_MAX, sched)) {
+				break;
+			}
+			result->nodes++;
+		}
+		if (hasError()) {
+			return false; // 矛盾した。解はない
+		}
+		if (isSolved()) {
+			result->count = 1;
+			return true;
+		}
+		// 残りの探索には、確定に使った分を差し引いたノード数を許す
+		SU_LIMIT rest = limit;
+		if (limit.maxnodes > 0) {
+			if (result->nodes >= limit.maxnodes) {
+				result->status = SU_SEARCH_BUDGET;
+				return false;
+			}
+			rest.maxnodes = limit.maxnodes - result->nodes;
+		}
+		int answer[SU_SIZE];
+		CSudokuDLX *dlx = new CSudokuDLX(m_rule);
+		dlx->load(m_num);
+		dlx->setLimit(&rest);
+		result->count = dlx->enumerate([&](const int *num) {
+			su_Copy(answer, num);
+			return false; // 最初の解で終わり
+		});
+		result->status = dlx->getStatus();
+		result->nodes += dlx->getNodes();
+		delete dlx;
+		if (result->count == 0) {
+			return false;
+		}
+		for (int i=0; i<SU_SIZE; i++) {
+			if (m_num[i] == 0) {
+				set(i % 9, i / 9, answer[i]);
+			}
+		}
+		m_lastx = -1;
+		m_lasty = -1;
+		return true;
+	}
+
+	// すべての解を列挙する。解が見つかるたびに func(const int *num) を呼ぶ
+	// func が false を返したら打ち切る。列挙した解の数を返す
+	template <class FUNC> unsigned long long enumerateSolutions(FUNC func) const {
+		CSudokuDLX *dlx = new CSudokuDLX(m_rule);
+		dlx->load(m_num);
+		unsigned long long n = dlx->enumerate(func);
+		delete dlx;
+		return n;
+	}
 
-		int n = get(x, y);
-		if (n > 0) {
-			int attr = 0;
-			if (n == lastn) {
-				attr |= TEXTATTR_EQUL;
+	// 各マスについて、少なくとも１つの解でそのマスに入る数字の集合を求める
+	// masks[i] にマス i の数字の集合（su_Bit の論理和）が入る。数字の入っているマスはその数字だけになる
+	// set() が管理するヒントは同じ行・列・ブロックの数字しか見ていないが、こちらは実際に解があるものだけを残す。
+	// 解を１つ見つけたら、その解に現れる 81 個の（マス, 数字）の組すべてに印をつける。
+	// まだ印のない組についてだけ、その数字をそのマスに置いた盤面の解を１つ探す（見つかればその解の組にも印をつける）
+	// 解がなければ false を返し、masks はすべて 0 になる。searches を指定すると、解を探した回数が入る
+	bool getSolutionCandidates(int *masks, int *searches=NULL) const {
+		su_ZeroClear(masks);
+		int cnt = 0;
+		CSudokuDLX *dlx = new CSudokuDLX(m_rule);
+		auto mark = [&](const int *num) {
+			for (int i=0; i<SU_SIZE; i++) {
+				masks[i] |= su_Bit(num[i]);
 			}
-			if (m_attr[su_IndexOf(x, y)] == TEXTATTR_INIT) {
-				attr |= TEXTATTR_INIT;
-			} else if (x==m_lastx && y==m_lasty) {
-				attr |= TEXTATTR_CUR;
+			return false; // 解は１つ見つかれば十分
+		};
+		dlx->load(m_num);
+		cnt++;
+		bool found = dlx->enumerate(mark) > 0;
+		if (found) {
+			for (int i=0; i<SU_SIZE; i++) {
+				if (m_num[i] > 0) continue;
+				// 同じハウスにすでにある数字は、探すまでもなく入らない
+				int local = SU_BIT_ALL;
+				const int *peers = m_rule->peers[i];
+				for (int k=0; k<m_rule->numpeers[i]; k++) {
+					if (m_num[peers[k]] > 0) local &= ~su_Bit(m_num[peers[k]]);
+				}
+				for (int n=1; n<=9; n++) {
+					int bit = su_Bit(n);
+					if ((local & bit) == 0 || (masks[i] & bit)) continue;
+					dlx->load(m_num);
+					dlx->place(i * 9 + n - 1);
+					cnt++;
+					dlx->enumerate(mark);
+				}
 			}
-			su_SetConsoleTextAttr(attr);
-			printf("%d", n);
-			su_SetConsoleTextAttr(TEXTATTR_NONE);
-
-		} else {
-			putchar(' ');
 		}
+		delete dlx;
+		if (searches) *searches = cnt;
+		return found;
 	}
 
-	// 数字の並びをプリント
-	void print() const {
-		#define N(x, y) printNum(x, y)
-		#define SEP  putchar('|')
-		#define CR  putchar('\n')
-		printf("+---+---+---+\n");
-		SEP, N(0,0), N(1,0), N(2,0), SEP, N(3,0), N(4,0), N(5,0), SEP, N(6,0), N(7,0), N(8,0); SEP; CR;
-		SEP, N(0,1), N(1,1), N(2,1), SEP, N(3,1), N(4,1), N(5,1), SEP, N(6,1), N(7,1), N(8,1); SEP; CR;
-		SEP, N(0,2), N(1,2), N(2,2), SEP, N(3,2), N(4,2), N(5,2), SEP, N(6,2), N(7,2), N(8,2); SEP; CR;
-		printf("+---+---+---+\n");
-		SEP, N(0,3), N(1,3), N(2,3), SEP, N(3,3), N(4,3), N(5,3), SEP, N(6,3), N(7,3), N(8,3); SEP; CR;
-		SEP, N(0,4), N(1,4), N(2,4), SEP, N(3,4), N(4,4), N(5,4), SEP, N(6,4), N(7,4), N(8,4); SEP; CR;
-		SEP, N(0,5), N(1,5), N(2,5), SEP, N(3,5), N(4,5), N(5,5), SEP, N(6,5), N(7,5), N(8,5); SEP; CR;
-		printf("+---+---+---+\n");
-		SEP, N(0,6), N(1,6), N(2,6), SEP, N(3,6), N(4,6), N(5,6), SEP, N(6,6), N(7,6), N(8,6); SEP; CR;
-		SEP, N(0,7), N(1,7), N(2,7), SEP, N(3,7), N(4,7), N(5,7), SEP, N(6,7), N(7,7), N(8,7); SEP; CR;
-		SEP, N(0,8), N(1,8), N(2,8), SEP, N(3,8), N(4,8), N(5,8), SEP, N(6,8), N(7,8), N(8,8); SEP; CR;
-		printf("+---+---+---+\n");
-		#undef CR
-		#undef SEP
-		#undef N
-		if (m_lastmsg[0]) {
-			printf("【赤いマスに注目してください】\n");
-			printf("%s\n", m_lastmsg);
+	// 正解パターンの数字、列、行をランダムに count 回入れ替える
+	// 変則ルールでは行や列を入れ替えると正解でなくなるので、数字だけを入れ替える
+	void shuffle(int count) {
+		bool classic = m_rule == su_ClassicRule();
+		// 入れ替えを１つの変換に合成してから、盤面には１回だけ適用する
+		SU_TRANSFORM t, s;
+		su_IdentityTransform(&t);
+		for (int i=0; i<count; i++) {
+			int a, b;
+			switch (classic ? su_Rand() % 3 : 0) {
+			case 0:
+				su_GetRandomIntPair(&a, &b);
+				su_NumSwapTransform(&s, a, b);
+				break;
+			case 1:
+				su_GetRandomLinePair(&a, &b);
+				su_ColSwapTransform(&s, a, b);
+				break;
+			case 2:
+				su_GetRandomLinePair(&a, &b);
+				su_RowSwapTransform(&s, a, b);
+				break;
+			}
+			su_ComposeTransform(&t, t, s);
 		}
+		transform(t);
 	}
 
-	// 問題解決の手順を１段階だけ進める
-	bool stepSolve() {
-		setHow("");
-		for (int y=0; y<9; y++) {
-			if (step_last_cell_in_row(y)) {
-				return true;
-			}
+	// 条件 param を満たす問題を作る
+	// 正解パターンを作り、対称性を保ったまま数字を消していく。
+	// 条件を満たせないことが分かった時点でその正解パターンを捨てて作り直す。
+	// param.maxtries 回作り直しても条件を満たせなければ false を返す
+	// 対称性からしてヒント数が作れない組み合わせなら、正解パターンを作らずに false を返す
+	bool makeProblem(const SU_GENPARAM &param, SU_GENSTAT *stat=NULL) {
+		SU_GENSTAT dummy;
+		if (stat == NULL) stat = &dummy;
+		memset(stat, 0, sizeof(SU_GENSTAT));
+		if (!su_CluesReachable(param.symmetry, param.clues)) {
+			stat->rejectClues++;
+			return false;
 		}
-		for (int x=0; x<9; x++) {
-			if (step_last_cell_in_col(x)) {
+
+		for (int t=0; t<param.maxtries; t++) {
+			if (!make()) {
+				return false; // このルールには正解パターンがない
+			}
+			stat->tries++;
+			if (digProblem(param, stat)) {
 				return true;
 			}
 		}
-		for (int by=0; by<3; by++) {
-			for (int bx=0; bx<3; bx++) {
-				if (step_last_cell_in_block(bx, by)) {
-					return true;
-				}
-			}
+		return false;
+	}
+
+	// 正解パターンから軌道単位で数字を消して、条件 param を満たす問題にする
+	// 条件を満たせないと分かった時点で false を返す
+	// 盤面は正解パターン（すべてのマスが埋まった状態）でないといけない
+	bool digProblem(const SU_GENPARAM &param, SU_GENSTAT *stat) {
+		if (!su_CluesReachable(param.symmetry, param.clues)) {
+			stat->rejectClues++;
+			return false;
 		}
+		int maxlevel = param.level > 0 ? param.level : SU_LEVEL_MAX;
+		int orbits[SU_SIZE][4];
+		int sizes[SU_SIZE];
+		int numorbits = su_GetSymmetryOrbits(param.symmetry, orbits, sizes);
 
-		for (int y=0; y<9; y++) {
-			for (int n=1; n<=9; n++) {
-				if (step_row_uq(y, n)) {
-					return true;
-				}
-			}
+		// 消す順番をシャッフル
+		int order[SU_SIZE];
+		for (int i=0; i<numorbits; i++) {
+			order[i] = i;
 		}
-		for (int x=0; x<9; x++) {
-			for (int n=1; n<=9; n++) {
-				if (step_col_uq(x, n)) {
-					return true;
-				}
-			}
+		for (int i=numorbits-1; i>0; i--) {
+			std::swap(order[i], order[su_Rand() % (i+1)]);
 		}
-		for (int n=1; n<=9; n++) {
-			if (step_cell_uq(n)) {
-				return true;
-			}
+
+		int clues = getClueCount();
+		int rest = SU_SIZE; // まだ消すのを試していないマスの数
+		CSudokuScheduler sched; // 同じ正解パターンから作る盤面どうしなので、手筋の成績を使い回す
+		CSudokuUnavoidables unavoidables;
+		unavoidables.build(m_rule, m_num);
+		SU_CELLMASK cluemask = {0, 0}; // ヒントの残っているマス
+		for (int i=0; i<SU_SIZE; i++) {
+			su_CellMaskAdd(&cluemask, i);
 		}
-		for (int suby=0; suby<3; suby++) {
-			for (int subx=0; subx<3; subx++) {
-				for (int n=1; n<=9; n++) {
-					if (step_block_uq(subx, suby, n)) {
-						return true;
-					}
-				}
+		// 難易度の枝刈りは軌道を levelPruneInterval 個試すごとに行う
+		// 枝刈りの判定は、ほぼ空っぽの盤面を解かせるので、軌道１つの判定と同じくらいかそれ以上かかる。
+		// 毎回やると解く回数が倍になるが、8 個ごとなら増えるのは 1/8 ほどで済み、見込みのない正解パターンも早めに捨てられる
+		const int levelPruneInterval = 8;
+		for (int k=0; k<numorbits; k++) {
+			const int *orbit = orbits[order[k]];
+			int size = sizes[order[k]];
+			rest -= size;
+			if (param.clues > 0 && clues - size < param.clues) {
+				continue; // 消すと目標のヒント数を下回る
 			}
-		}
-		return false;
-	}
 
-	// どこかダメな点があるか？
-	bool hasError() const {
-		// 行の数字が重複している
-		for (int y=0; y<9; y++) {
-			int m = 0;
-			for (int x=0; x<9; x++) {
-				int n = get(x, y);
-				if (n > 0) {
-					int bit = su_Bit(n);
-					if (m & bit) {
-						return true; // 重複
-					}
-					m |= bit;
+			// 軌道上の数字をまとめて消しても解ける？
+			// 一度消せなかった軌道は、ほかの数字を消した後でもやはり消せない
+			// 回避不能集合のヒントがなくなるなら唯一解でなくなるので、解いてみるまでもない
+			int tmp[SU_SIZE];
+			CSudokuGrid grid;
+			grid.setRule(m_rule);
+			if (unavoidables.wouldEmpty(cluemask, orbit, size)) {
+				stat->skips++;
+			} else {
+				su_Copy(tmp, m_num);
+				for (int i=0; i<size; i++) {
+					tmp[orbit[i]] = 0;
 				}
-			}
-		}
-		// 列の数字が重複しない
-		for (int x=0; x<9; x++) {
-			int m = 0;
-			for (int y=0; y<9; y++) {
-				int n = get(x, y);
-				if (n > 0) {
-					int bit = su_Bit(n);
-					if (m & bit) {
-						return true; // 重複
+				grid.loadFromArray(tmp);
+				stat->solves++;
+				if (grid.canSolve(maxlevel, &sched)) {
+					loadFromArray(tmp);
+					clues -= size;
+					for (int i=0; i<size; i++) {
+						su_CellMaskRemove(&cluemask, orbit[i]);
 					}
-					m |= bit;
 				}
 			}
-		}
-		// ブロック内の数字が重複しない
-		for (int by=0; by<3; by++) {
-			for (int bx=0; bx<3; bx++) {
-				int m = 0;
-				for (int y=0; y<3; y++) {
-					for (int x=0; x<3; x++) {
-						int n = get(bx*3+x, by*3+y);
-						if (n > 0) {
-							int bit = su_Bit(n);
-							if (m & bit) {
-								return true; // 重複
-							}
-							m |= bit;
-						}
+			if (param.clues > 0 && clues == param.clues) {
+				break;
+			}
+
+			// 枝刈り：残りの軌道をすべて消せたとしても目標のヒント数まで減らない
+			if (param.clues > 0 && clues - rest > param.clues) {
+				stat->rejectClues++;
+				return false;
+			}
+
+			// 枝刈り：残りの軌道をすべて消した盤面でも簡単な手筋だけで解けてしまうなら、
+			// これ以上消しても目標の難易度には届かない
+			if (param.level > SU_LEVEL_EASY && k % levelPruneInterval == levelPruneInterval - 1) {
+				su_Copy(tmp, m_num);
+				for (int j=k+1; j<numorbits; j++) {
+					for (int i=0; i<sizes[order[j]]; i++) {
+						tmp[orbits[order[j]][i]] = 0;
 					}
 				}
+				grid.loadFromArray(tmp);
+				stat->solves++;
+				if (grid.canSolve(param.level - 1, &sched)) {
+					stat->rejectLevel++;
+					return false;
+				}
 			}
 		}
-		return false;
-	}
-
-	// 完成した？
-	bool isSolved() const {
-		// 重複なし？
-		if (hasError()) {
-			su_SetConsoleTextAttr(TEXTATTR_ERR);
-			printf("[エラー] 数字が重複しています");
-			su_SetConsoleTextAttr(TEXTATTR_NONE);
-			printf("\n\n");
+		if (param.clues > 0 && clues != param.clues) {
+			stat->rejectClues++;
 			return false;
 		}
-		// 全てのマスに数字が入っている？
-		for (int y=0; y<9; y++) {
-			for (int x=0; x<9; x++) {
-				if (get(x, y) == 0) {
-					return false;
-				}
+		if (param.level > SU_LEVEL_EASY) {
+			stat->solves++;
+			if (canSolve(param.level - 1, &sched)) {
+				stat->rejectLevel++;
+				return false;
 			}
 		}
+		m_lastx = -1;
+		m_lasty = -1;
 		return true;
 	}
 
-	// 正解条件を満たしている盤面を適当に作成する（すべてのマスに数字が埋まっている状態）
-	void make() {
-		loadFromString(
-			"123456789"
-			"456789123"
-			"789123456"
-			"234567891"
-			"567891234"
-			"891234567"
-			"345678912"
-			"678912345"
-			"912345678"
-		);
-		assert(isSolved());
-	}
-
-	// 問題を解くことができる？
-	bool canSolve() {
-		CSudokuGrid grid;
-		grid.loadFromArray(m_num);
-		while (grid.stepSolve()) {
-		}
-		return grid.isSolved();
-	}
-
 	// 「問題が解ける状態を維持したまま」ランダムで数字を一つ消す
 	// どのマスを消しても問題が解けなくなってしまう場合は false を返す
 	bool removeRandomOne() {
+		SU_PROF_SCOPE(SU_PROF_REMOVERANDOMONE);
 		// 数字が入っているセルのインデックスを並べる
 		int pos[SU_SIZE] = {0};
 		int cnt = 0;
@@ -525,13 +2429,38 @@ public:
 		}
 		// シャッフル
 		for (int i=0; i<cnt*2; i++) {
-			int a = rand() % cnt;
-			int b = rand() % cnt;
+			int a = su_Rand() % cnt;
+			int b = su_Rand() % cnt;
 			std::swap(pos[a], pos[b]);
 		}
 
+		// 解答の回避不能集合を調べておき、そのヒントがなくなるマスは解いてみずに飛ばす
+		// 前回の解答が今のヒントと矛盾しなければ、それが解答なので索引を使い回す
+		// （消したあとの盤面が解けるなら解は１つだけで、それはヒントと矛盾しない前回の解答と同じ）
+		static thread_local SU_UNAVOIDABLECACHE cache;
+		bool same = cache.valid && cache.rule == m_rule;
+		for (int i=0; i<SU_SIZE && same; i++) {
+			if (m_num[i] > 0 && m_num[i] != cache.solution[i]) same = false;
+		}
+		if (!same) {
+			cache.rule = m_rule;
+			cache.valid = enumerateSolutions([&](const int *num) { su_Copy(cache.solution, num); return false; }) > 0;
+			if (cache.valid) {
+				cache.sets.build(m_rule, cache.solution);
+			}
+		}
+		SU_CELLMASK cluemask = {0, 0};
+		for (int i=0; i<cnt; i++) {
+			su_CellMaskAdd(&cluemask, pos[i]);
+		}
+
 		// 数字を一つ消しても解けるか確認する。解けなければ次のセル数字を消してみる
+		CSudokuScheduler sched;
 		for (int i=0; i<cnt; i++) {
+			if (cache.valid && cache.sets.wouldEmpty(cluemask, &pos[i], 1)) {
+				continue;
+			}
+
 			// 盤面複製
 			int tmp[SU_SIZE];
 			su_Copy(tmp, m_num);
@@ -542,8 +2471,11 @@ public:
 
 			// 解ける？
 			CSudokuGrid grid;
+			grid.setRule(m_rule);
 			grid.loadFromArray(tmp);
-			if (grid.canSolve()) {
+			SU_PROF_NODES(SU_PROF_REMOVERANDOMONE, 1);
+			if (grid.canSolve(SU_LEVEL_MAX, &sched)) {
+				SU_PROF_HIT(SU_PROF_REMOVERANDOMONE);
 				// OK. この盤面をセットする
 				loadFromArray(tmp);
 				m_lastx = p % 9;
@@ -556,218 +2488,300 @@ public:
 
 	// y0 と y1 にある行（横一列）を入れ替える
 	void swapRow(int y0, int y1) {
-		assert(isSolved());
 		if (y0==y1) return;
-		for (int x=0; x<9; x++) {
-			std::swap(m_num[su_IndexOf(x, y0)], m_num[su_IndexOf(x, y1)]);
-		}
-		assert(isSolved());
+		SU_TRANSFORM t;
+		su_RowSwapTransform(&t, y0, y1);
+		transform(t);
 	}
 
 	// x0 と x1 にある列（縦一列）を入れ替える
 	void swapCol(int x0, int x1) {
-		assert(isSolved());
 		if (x0==x1) return;
-		for (int y=0; y<9; y++) {
-			std::swap(m_num[su_IndexOf(x0, y)], m_num[su_IndexOf(x1, y)]);
-		}
-		assert(isSolved());
+		SU_TRANSFORM t;
+		su_ColSwapTransform(&t, x0, x1);
+		transform(t);
 	}
 
 	// 番号 n0 と n1 を全て入れ替える
 	void swapNum(int n0, int n1) {
-		assert(isSolved());
 		if (n0==n1) return;
+		SU_TRANSFORM t;
+		su_NumSwapTransform(&t, n0, n1);
+		transform(t);
+	}
+
+	// 盤面に変換 t を適用する（数字と一緒に、マスの属性とヒントも移す）
+	// t が数独の対称群の元なら、同じ行・列・ブロックにある数字は変換後も同じ行・列・ブロックに入るので、正解パターンは正解パターンのまま
+	void transform(const SU_TRANSFORM &t) {
+		int num[SU_SIZE];
+		int attr[SU_SIZE];
+		int hint[SU_SIZE];
+		su_ApplyTransform(t, m_num, num);
+		for (int i=0; i<SU_SIZE; i++) {
+			attr[i] = m_attr[t.cell[i]];
+			int m = m_hint[t.cell[i]];
+			int h = 0;
+			for (int n=1; n<=9; n++) {
+				if (m & su_Bit(n)) h |= su_Bit(t.digit[n]);
+			}
+			hint[i] = h;
+		}
+		su_Copy(m_num, num);
+		su_Copy(m_attr, attr);
+		su_Copy(m_hint, hint);
+		m_lastx = -1;
+		m_lasty = -1;
+		recount();
+	}
+private:
+	// マス (x, y) の数字 num の個数を delta だけ増やす
+	void countNum(int x, int y, int num, int delta) {
+		int cell = su_IndexOf(x, y);
+		for (int k=0; k<m_rule->numcellhouses[cell]; k++) {
+			int &c = m_count[m_rule->cellhouses[cell][k]][num];
+			if (delta > 0 && c == 1) m_conflicts++; // 1個 → 2個で重複になる
+			if (delta < 0 && c == 2) m_conflicts--; // 2個 → 1個で重複が解消
+			c += delta;
+		}
+		m_filled += delta;
+	}
+
+	// m_num を直接書き換えた後で、個数を数え直す
+	void recount() {
+		memset(m_count, 0, sizeof(m_count));
+		m_filled = 0;
+		m_conflicts = 0;
 		for (int y=0; y<9; y++) {
 			for (int x=0; x<9; x++) {
-				int i = su_IndexOf(x, y);
-				// n0 <==> n1
-				if (m_num[i] == n0) {
-					m_num[i] = n1;
-				} else if (m_num[i] == n1) {
-					m_num[i] = n0;
+				int n = get(x, y);
+				if (n > 0) {
+					countNum(x, y, n, 1);
 				}
 			}
 		}
-		assert(isSolved());
 	}
-private:
-	// 行の9マスのうち8マスが既に埋まっているなら、残りの1マスの数字が確定できる
-	bool step_last_cell_in_row(int y) {
-		// ひとつだけ未使用の数字を探す
-		assert(0 <= y && y < 9);
-		std::unordered_set<int> s;
-		s.insert({1,2,3,4,5,6,7,8,9});
-		int xx = -1;
-		for (int x=0; x<9; x++) {
-			int n = get(x, y);
-			if (n > 0) {
-				s.erase(n);
-			} else {
-				xx = x;
-			}
+
+	// 手筋を決められた順番で試し、最初に成功したもので数字を１つ確定させる
+	bool step_any(int maxlevel) {
+		setHow("");
+		m_lasttech = SU_TECH_NONE;
+		if (maxlevel >= SU_LEVEL_EASY && step_last_cells()) {
+			return true;
 		}
-		if (s.size() == 1) { // ひとつだけセルが空いている。余った数字を入れる
-			assert(xx >= 0);
-			int n = *s.begin();
-			set(xx, y, n);
-			setHow("この横一列には空きマスが１つしかないため、このマスは %d で確定です", n);
+		if (maxlevel >= SU_LEVEL_NORMAL && step_line_uqs()) {
 			return true;
 		}
-		return false;
-	}
-	// 列の9マスのうち8マスが既に埋まっているなら、残りの1マスの数字が確定できる
-	bool step_last_cell_in_col(int x) {
-		assert(0 <= x && x < 9);
-		// 使用済みの数字を消す
-		std::unordered_set<int> s;
-		s.insert({1,2,3,4,5,6,7,8,9});
-		int yy = -1;
-		for (int y=0; y<9; y++) {
-			int n = get(x, y);
-			if (n > 0) {
-				s.erase(n);
-			} else {
-				yy = y;
-			}
+		if (maxlevel >= SU_LEVEL_HARD && step_cell_uqs()) {
+			return true;
 		}
-		if (s.size() == 1) { // ひとつだけセルが空いている。余った数字を入れる
-			assert(yy >= 0);
-			int n = *s.begin();
-			set(x, yy, n);
-			setHow("この縦一列には空きマスが１つしかないため、このマスは %d で確定です", n);
+		if (maxlevel >= SU_LEVEL_NORMAL && step_block_uqs()) {
 			return true;
 		}
 		return false;
 	}
-	// ブロックの9マスのうち8マスが既に埋まっているなら、残りの1マスの数字が確定できる
-	// subx, suby ブロック番号。ブロックは 3x3 個あり、左から順に subx=0, 1, 2、上から順に suby=0, 1, 2 になる
-	bool step_last_cell_in_block(int subx, int suby) {
-		assert(0 <= subx && subx < 3);
-		assert(0 <= suby && suby < 3);
-		// 使用済みの数字を消す
-		std::unordered_set<int> s;
-		s.insert({1,2,3,4,5,6,7,8,9});
-		int xx = -1;
-		int yy = -1;
-		for (int y=0; y<3; y++) {
-			for (int x=0; x<3; x++) {
-				int cx = subx * 3 + x;
-				int cy = suby * 3 + y;
-				int n = get(cx, cy);
-				if (n > 0) {
-					s.erase(n);
-				} else {
-					xx = cx;
-					yy = cy;
-				}
+
+	// レベル level の手筋だけを試して数字を１つ確定させる
+	bool step_level(int level) {
+		setHow("");
+		m_lasttech = SU_TECH_NONE;
+		switch (level) {
+		case SU_LEVEL_EASY:
+			return step_last_cells();
+		case SU_LEVEL_NORMAL:
+			return step_line_uqs() || step_block_uqs();
+		case SU_LEVEL_HARD:
+			return step_cell_uqs();
+		}
+		return false;
+	}
+
+	// sched が決めた順番で、レベルが maxlevel 以下の手筋を試して数字を１つ確定させる
+	bool step_scheduled(CSudokuScheduler &sched, int maxlevel) {
+		setHow("");
+		m_lasttech = SU_TECH_NONE;
+		int order[SU_STEP_COUNT]; // record() が並びを変えるので、先に写しておく
+		for (int k=0; k<SU_STEP_COUNT; k++) {
+			order[k] = sched.getOrder(k);
+		}
+		for (int k=0; k<SU_STEP_COUNT; k++) {
+			int step = order[k];
+			if (su_StepLevel(step) > maxlevel) continue;
+			m_scanned = 0;
+			bool ok = false;
+			switch (step) {
+			case SU_STEP_LAST_CELLS: ok = step_last_cells(); break;
+			case SU_STEP_LINE_UQS:   ok = step_line_uqs(); break;
+			case SU_STEP_CELL_UQS:   ok = step_cell_uqs(); break;
+			case SU_STEP_BLOCK_UQS:  ok = step_block_uqs(); break;
 			}
+			sched.record(step, ok, m_scanned);
+			if (ok) return true;
 		}
-		if (s.size() == 1) { // ひとつだけセルが空いている。余った数字を入れる
-			assert(xx >= 0 && yy >= 0);
-			int n = *s.begin();
-			set(xx, yy, n);
-			setHow("このブロックには空きマスが１つしかないため、このマスは %d で確定です", n);
-			return true;
+		return false;
+	}
+
+	// 空きマスが１つしかない行・列・ブロックを探す
+	bool step_last_cells() {
+		for (int h=0; h<m_rule->numhouses; h++) {
+			if (step_last_cell_in_house(h)) {
+				return true;
+			}
 		}
 		return false;
 	}
-	// num しか入らないとわかっているマスがあるなら、そのマスの数字を num で確定する
-	bool step_cell_uq(int num) {
-		// そのマスには num しか入らない
-		assert(1 <= num && num <= 9);
-		for (int y=0; y<9; y++) {
-			for (int x=0; x<9; x++) {
-				if (isHintUnique(x, y, num)) { // このマスにあるヒントは num だけ ＝ このマスには num しか入る数字が無い ＝ このマスの数字は num で確定
-					set(x, y, num);
-					setHow("このマスに入る数字は %d しかありません。\n縦横列およびブロック内には、他の８種類の数字がすでに入っています", num);
+
+	// 行・列の中で数字が入るマスが１つしかないものを探す
+	bool step_line_uqs() {
+		for (int h=0; h<18; h++) { // ハウス 0～17 は行と列
+			for (int n=1; n<=9; n++) {
+				if (step_house_uq(h, n)) {
 					return true;
 				}
 			}
 		}
 		return false;
 	}
-	// 指定ブロック(3x3) にある9マスを調べる。
-	// このうち、ヒントに num を含んでいるマスがただひとつしかないなら、num はそのマスにしか入らない
-	bool step_block_uq(int subx, int suby, int num) {
-		assert(0 <= subx && subx < 3);
-		assert(0 <= suby && suby < 3);
-		assert(1 <= num && num <= 9);
-		// サブブロックに入る num は一か所しかない
-		int cx=-1;
-		int cy=-1;
-		bool found = false;
-		for (int y=0; y<3; y++) {
-			for (int x=0; x<3; x++) {
-				int xx = subx * 3 + x;
-				int yy = suby * 3 + y;
-				if (hasHint(xx, yy, num)) {
-					if (found) {
-						// 二つめのマスが見つかってしまった。
-						// num が入る可能性があるマスが複数あるのでダメ
-						return false;
-					}
-					cx = xx; // num をヒントに持つマスを記録しておく
-					cy = yy;
-					found = true;
-				}
+
+	// 入る数字が１つしかないマスを探す
+	// 数字ごとに81マスを調べ直すかわりに、81マスを１回だけ見る。
+	// 確定させるマスは数字ごとに調べた場合と同じ（いちばん小さい数字の、いちばん左上のマス）
+	bool step_cell_uqs() {
+		SU_PROF_SCOPE(SU_TECH_CELL_UQ);
+		int found = -1;
+		int foundbit = su_Bit(9) << 1;
+		for (int i=0; i<SU_SIZE; i++) {
+			int m = m_hint[i];
+			if (m != 0 && (m & (m - 1)) == 0 && m < foundbit) {
+				found = i;
+				foundbit = m;
+				if (m == su_Bit(1)) break; // これより小さい数字はない
 			}
 		}
-		if (found) {
-			// num をヒントに含むマスは一つしかなかった。
-			// そのマスに入る数字は num で確定した
-			set(cx, cy, num);
-			setHow("このブロック内で %d が入る可能性があるマスはここしかありません", num);
-			return true;
+		m_scanned += found >= 0 && foundbit == su_Bit(1) ? found + 1 : SU_SIZE;
+		if (found < 0) {
+			return false;
 		}
-		return false;
+		int num = 1;
+		while (su_Bit(num) != foundbit) num++;
+		set(found % 9, found / 9, num);
+		m_lasttech = SU_TECH_CELL_UQ;
+		SU_PROF_HIT(SU_TECH_CELL_UQ);
+		setHow("このマスに入る数字は %d しかありません。\n縦横列およびブロック内には、他の８種類の数字がすでに入っています", num);
+		return true;
 	}
 
-	// 指定された行（横一列）にある9マスを調べる。
-	// このうち、ヒントに num を含んでいるマスがただひとつしかないなら、num はそのマスにしか入らない
-	bool step_row_uq(int y, int num) {
-		assert(0 <= y && y < 9);
-		assert(1 <= num && num <= 9);
-		// この行に入る num は一か所しかない
-		int cx=-1;
-		bool found = false;
-		for (int x=0; x<9; x++) {
-			if (hasHint(x, y, num)) {
-				if (found) {
-					return false; // 重複
+	// ブロック（と対角線などのハウス）の中で数字が入るマスが１つしかないものを探す
+	bool step_block_uqs() {
+		for (int h=18; h<m_rule->numhouses; h++) {
+			for (int n=1; n<=9; n++) {
+				if (step_house_uq(h, n)) {
+					return true;
 				}
-				cx = x;
-				found = true;
 			}
 		}
-		if (found) {
-			set(cx, y, num);
-			setHow("この横一列の９マス内で %d が入る可能性があるマスはここしかありません", num);
+		return false;
+	}
+
+	// ハウスの種類ごとの手筋と説明
+	static int houseLastTech(int kind) {
+		switch (kind) {
+		case SU_HOUSE_ROW: return SU_TECH_LAST_IN_ROW;
+		case SU_HOUSE_COL: return SU_TECH_LAST_IN_COL;
+		}
+		return SU_TECH_LAST_IN_BLOCK;
+	}
+	static int houseUqTech(int kind) {
+		switch (kind) {
+		case SU_HOUSE_ROW: return SU_TECH_ROW_UQ;
+		case SU_HOUSE_COL: return SU_TECH_COL_UQ;
+		}
+		return SU_TECH_BLOCK_UQ;
+	}
+	static const char *houseLastMsg(int kind) {
+		switch (kind) {
+		case SU_HOUSE_ROW:    return "この横一列には空きマスが１つしかないため、このマスは %d で確定です";
+		case SU_HOUSE_COL:    return "この縦一列には空きマスが１つしかないため、このマスは %d で確定です";
+		case SU_HOUSE_REGION: return "この領域には空きマスが１つしかないため、このマスは %d で確定です";
+		case SU_HOUSE_DIAG:   return "この対角線には空きマスが１つしかないため、このマスは %d で確定です";
+		case SU_HOUSE_WINDOW: return "この窓には空きマスが１つしかないため、このマスは %d で確定です";
+		}
+		return "このブロックには空きマスが１つしかないため、このマスは %d で確定です";
+	}
+	static const char *houseUqMsg(int kind) {
+		switch (kind) {
+		case SU_HOUSE_ROW:    return "この横一列の９マス内で %d が入る可能性があるマスはここしかありません";
+		case SU_HOUSE_COL:    return "この縦一列の９マス内で %d が入る可能性があるマスはここしかありません";
+		case SU_HOUSE_REGION: return "この領域内で %d が入る可能性があるマスはここしかありません";
+		case SU_HOUSE_DIAG:   return "この対角線上で %d が入る可能性があるマスはここしかありません";
+		case SU_HOUSE_WINDOW: return "この窓の中で %d が入る可能性があるマスはここしかありません";
+		}
+		return "このブロック内で %d が入る可能性があるマスはここしかありません";
+	}
+
+	// ハウスの9マスのうち8マスが既に埋まっているなら、残りの1マスの数字が確定できる
+	// h はハウス番号（0～8 が行、9～17 が列、18～26 がブロック、それ以降が対角線など）
+	bool step_last_cell_in_house(int h) {
+		assert(0 <= h && h < m_rule->numhouses);
+		int tech = houseLastTech(m_rule->kind[h]);
+		SU_PROF_SCOPE(tech);
+		m_scanned += 9;
+		// 使用済みの数字を消していき、ひとつだけ未使用の数字を探す
+		int rest = SU_BIT_ALL;
+		int cell = -1;
+		int empties = 0;
+		const int *cells = m_rule->house[h];
+		for (int k=0; k<9; k++) {
+			int n = m_num[cells[k]];
+			if (n > 0) {
+				rest &= ~su_Bit(n);
+			} else {
+				cell = cells[k];
+				empties++;
+			}
+		}
+		// ひとつだけセルが空いている。余った数字を入れる
+		// （空きマスがなくても、同じ数字が２つあると余る数字が１つになるので、空きマスの数で確かめる）
+		if (empties == 1 && cell >= 0 && rest != 0 && (rest & (rest - 1)) == 0) {
+			int n = 1;
+			while (su_Bit(n) != rest) n++;
+			set(cell % 9, cell / 9, n);
+			m_lasttech = tech;
+			SU_PROF_HIT(tech);
+			setHow(houseLastMsg(m_rule->kind[h]), n);
 			return true;
 		}
 		return false;
 	}
-
-	// 指定された列（縦一列）にある9マスを調べる。
+	// 指定されたハウスにある9マスを調べる。
 	// このうち、ヒントに num を含んでいるマスがただひとつしかないなら、num はそのマスにしか入らない
-	bool step_col_uq(int x, int num) {
-		assert(0 <= x && x < 9);
+	bool step_house_uq(int h, int num) {
+		assert(0 <= h && h < m_rule->numhouses);
 		assert(1 <= num && num <= 9);
-		// この列に入る num は一か所しかない
-		int cy=-1;
-		bool found = false;
-		for (int y=0; y<9; y++) {
-			if (hasHint(x, y, num)) {
-				if (found) {
-					return false; // 重複
+		int tech = houseUqTech(m_rule->kind[h]);
+		SU_PROF_SCOPE(tech);
+		// このハウスに入る num は一か所しかない
+		int bit = su_Bit(num);
+		int cell = -1;
+		const int *cells = m_rule->house[h];
+		for (int k=0; k<9; k++) {
+			if (m_hint[cells[k]] & bit) {
+				if (cell >= 0) {
+					// 二つめのマスが見つかってしまった。
+					// num が入る可能性があるマスが複数あるのでダメ
+					m_scanned += k + 1;
+					return false;
 				}
-				cy = y;
-				found = true;
+				cell = cells[k]; // num をヒントに持つマスを記録しておく
 			}
 		}
-		if (found) {
-			set(x, cy, num);
-			setHow("この縦一列の９マス内で %d が入る可能性があるマスはここしかありません", num);
+		m_scanned += 9;
+		if (cell >= 0) {
+			// num をヒントに含むマスは一つしかなかった。
+			// そのマスに入る数字は num で確定した
+			set(cell % 9, cell / 9, num);
+			m_lasttech = tech;
+			SU_PROF_HIT(tech);
+			setHow(houseUqMsg(m_rule->kind[h]), num);
 			return true;
 		}
 		return false;
@@ -806,7 +2820,9 @@ void prob(CSudokuGrid grid) {
 // パターン作る
 void gen() {
 	CSudokuGrid grid;
-	grid.make();
+	if (!grid.make()) {
+		return;
+	}
 	grid.print();
 	while (1) {
 		printf("\n");
@@ -857,6 +2873,774 @@ void gen() {
 	}
 }
 
+#ifndef SU_NO_MAIN // コマンドは main() からしか使わない
+// 一度に読み込んで処理する問題の数
+static const int SU_BATCH_LINES = 65536;
+
+// 処理スレッド数。0 ならCPUのコア数にする
+static int su_GetThreadCount(int threads) {
+	if (threads <= 0) {
+		threads = (int)std::thread::hardware_concurrency();
+	}
+	return threads > 0 ? threads : 1;
+}
+
+// ファイルから問題を最大 maxlines 行読み込む。空行と # で始まる行は読み飛ばす
+// 読み込んだ行数を返す
+static int su_ReadLines(FILE *fp, std::vector<std::string> &lines, int maxlines) {
+	lines.clear();
+	char s[1024];
+	while ((int)lines.size() < maxlines && fgets(s, sizeof(s), fp)) {
+		s[strcspn(s, "\r\n")] = '\0';
+		if (s[0] == '\0' || s[0] == '#') {
+			continue;
+		}
+		lines.push_back(s);
+	}
+	return (int)lines.size();
+}
+
+// 0～count-1 の各 i について func(i) を threads 本のスレッドで並列に呼ぶ
+template <class FUNC> static void su_ParallelFor(int count, int threads, FUNC func) {
+	std::atomic<int> next(0);
+	auto worker = [&]() {
+		const int chunk = 256;
+		int i;
+		while ((i = next.fetch_add(chunk)) < count) {
+			int end = std::min(i + chunk, count);
+			for (; i<end; i++) {
+				func(i);
+			}
+		}
+	};
+	std::vector<std::thread> pool;
+	for (int t=1; t<threads; t++) {
+		pool.push_back(std::thread(worker));
+	}
+	worker();
+	for (size_t t=0; t<pool.size(); t++) {
+		pool[t].join();
+	}
+}
+
+// 問題集ファイル infile の全問題の難易度を判定して outfile に書き出す
+// 出力は１問につき１行で「問題 難易度 確定させた数字の数」。難易度 0 は単純な手筋だけでは解けないことを示す
+static bool su_GradeCorpus(const SU_RULE *rule, const char *infile, const char *outfile, int threads) {
+	FILE *in = fopen(infile, "r");
+	if (in == NULL) {
+		fprintf(stderr, "%s を開けません\n", infile);
+		return false;
+	}
+	FILE *out = fopen(outfile, "w");
+	if (out == NULL) {
+		fprintf(stderr, "%s を開けません\n", outfile);
+		fclose(in);
+		return false;
+	}
+	threads = su_GetThreadCount(threads);
+	auto start = std::chrono::steady_clock::now();
+	long long total = 0;
+	long long perlevel[SU_LEVEL_MAX+1] = {0};
+
+	std::vector<std::string> lines;
+	std::vector<std::string> records;
+	std::vector<int> levels;
+	while (su_ReadLines(in, lines, SU_BATCH_LINES) > 0) {
+		int cnt = (int)lines.size();
+		records.resize(cnt);
+		levels.resize(cnt);
+		su_ParallelFor(cnt, threads, [&](int i) {
+			CSudokuGrid grid;
+			grid.setRule(rule);
+			grid.loadFromString(lines[i].c_str());
+			char str[SU_SIZE+1];
+			grid.saveToString(str);
+			int steps = 0;
+			int level = grid.grade(&steps);
+			char rec[SU_SIZE+32];
+			snprintf(rec, sizeof(rec), "%s %d %d\n", str, level, steps);
+			records[i] = rec;
+			levels[i] = level;
+		});
+		for (int i=0; i<cnt; i++) {
+			fputs(records[i].c_str(), out);
+			perlevel[levels[i]]++;
+		}
+		total += cnt;
+	}
+	fclose(out);
+	fclose(in);
+
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	fprintf(stderr, "%lld 問 (%.2f 秒, %.0f 問/時, %d スレッド)\n", total, sec, sec > 0 ? total * 3600.0 / sec : 0.0, threads);
+	for (int lv=SU_LEVEL_NONE; lv<=SU_LEVEL_MAX; lv++) {
+		fprintf(stderr, "  難易度 %d: %lld\n", lv, perlevel[lv]);
+	}
+	return true;
+}
+
+// 解答ファイル infile の全解答が正しいか確かめる
+// １行に「解答」または「問題 解答」を書く（どちらも81文字）。問題があれば、解答が問題の数字と一致するかも確かめる
+// 問題の空きマスは空白でもよいので、区切りは最初の空白ではなく 82 文字目の空白とする
+// 正しくない行を stdout に書き出す
+static bool su_VerifyCorpus(const SU_RULE *rule, const char *infile, int threads) {
+	FILE *in = fopen(infile, "r");
+	if (in == NULL) {
+		fprintf(stderr, "%s を開けません\n", infile);
+		return false;
+	}
+	threads = su_GetThreadCount(threads);
+	auto start = std::chrono::steady_clock::now();
+	long long total = 0;
+	long long ng = 0;
+
+	std::vector<std::string> lines;
+	std::vector<const char *> errors;
+	while (su_ReadLines(in, lines, SU_BATCH_LINES) > 0) {
+		int cnt = (int)lines.size();
+		errors.assign(cnt, (const char *)NULL);
+		su_ParallelFor(cnt, threads, [&](int i) {
+			const char *line = lines[i].c_str();
+			bool haspuzzle = lines[i].size() > SU_SIZE && line[SU_SIZE] == ' ';
+			CSudokuGrid solution;
+			solution.setRule(rule);
+			solution.loadFromString(haspuzzle ? line + SU_SIZE + 1 : line);
+			if (solution.hasError()) {
+				errors[i] = "数字が重複しています";
+				return;
+			}
+			if (!solution.isSolved()) {
+				errors[i] = "空きマスがあります";
+				return;
+			}
+			if (haspuzzle) {
+				int puzzle[SU_SIZE];
+				int answer[SU_SIZE];
+				su_ImportNumbers(puzzle, line);
+				solution.saveToArray(answer);
+				for (int k=0; k<SU_SIZE; k++) {
+					if (puzzle[k] > 0 && puzzle[k] != answer[k]) {
+						errors[i] = "問題の数字と一致しません";
+						return;
+					}
+				}
+			}
+		});
+		for (int i=0; i<cnt; i++) {
+			if (errors[i]) {
+				printf("%lld: %s (%s)\n", total + i + 1, lines[i].c_str(), errors[i]);
+				ng++;
+			}
+		}
+		total += cnt;
+	}
+	fclose(in);
+
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	fprintf(stderr, "%lld 個中 %lld 個が正しくありません (%.2f 秒, %d スレッド)\n", total, ng, sec, threads);
+	return ng == 0;
+}
+
+// 問題集ファイル infile の全問題が最小か調べて outfile に書き出す
+// 出力は１問につき１行で「問題 判定 [消せるヒントのマス番号,...]」
+// 判定は minimal（最小）, redundant（消せるヒントがある）, multiple（解が複数）, nosolution（解なし）
+static bool su_MinimalCorpus(const SU_RULE *rule, const char *infile, const char *outfile, int threads) {
+	static const char *names[] = {"minimal", "redundant", "multiple", "nosolution"};
+	FILE *in = fopen(infile, "r");
+	if (in == NULL) {
+		fprintf(stderr, "%s を開けません\n", infile);
+		return false;
+	}
+	FILE *out = fopen(outfile, "w");
+	if (out == NULL) {
+		fprintf(stderr, "%s を開けません\n", outfile);
+		fclose(in);
+		return false;
+	}
+	threads = su_GetThreadCount(threads);
+	auto start = std::chrono::steady_clock::now();
+	long long total = 0;
+	long long perresult[4] = {0};
+
+	std::vector<std::string> lines;
+	std::vector<std::string> records;
+	std::vector<int> results;
+	while (su_ReadLines(in, lines, SU_BATCH_LINES) > 0) {
+		int cnt = (int)lines.size();
+		records.resize(cnt);
+		results.resize(cnt);
+		su_ParallelFor(cnt, threads, [&](int i) {
+			CSudokuGrid grid;
+			grid.setRule(rule);
+			grid.loadFromString(lines[i].c_str());
+			int redundant[SU_SIZE];
+			int num = 0;
+			int result = grid.checkMinimal(redundant, &num);
+			char str[SU_SIZE+1];
+			grid.saveToString(str);
+			std::string rec = str;
+			rec += " ";
+			rec += names[result];
+			for (int k=0; k<num; k++) {
+				char buf[8];
+				snprintf(buf, sizeof(buf), "%c%d", k == 0 ? ' ' : ',', redundant[k]);
+				rec += buf;
+			}
+			rec += "\n";
+			records[i] = rec;
+			results[i] = result;
+		});
+		for (int i=0; i<cnt; i++) {
+			fputs(records[i].c_str(), out);
+			perresult[results[i]]++;
+		}
+		total += cnt;
+	}
+	fclose(out);
+	fclose(in);
+
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	fprintf(stderr, "%lld 問 (%.2f 秒, %d スレッド)\n", total, sec, threads);
+	for (int r=0; r<4; r++) {
+		fprintf(stderr, "  %-10s %lld\n", names[r], perresult[r]);
+	}
+	return true;
+}
+
+// 問題 puzzle（81文字）を制限つきで解いて表示する
+// 打ち切った場合は、そこまでに確定させた盤面を表示する
+static bool su_SolveCommand(const SU_RULE *rule, const char *puzzle, long long timeout, unsigned long long maxnodes) {
+	static const char *status[] = {"完了", "時間切れ", "ノード数の上限", "キャンセル"};
+	CSudokuGrid grid;
+	grid.setRule(rule);
+	grid.loadFromString(puzzle);
+	SU_LIMIT limit;
+	if (timeout > 0) {
+		limit.setTimeout(timeout);
+	}
+	limit.maxnodes = maxnodes;
+	SU_SEARCHRESULT result;
+	bool ok = grid.solve(limit, &result);
+	char str[SU_SIZE+1];
+	grid.saveToString(str);
+	printf("%s\n", str);
+	fprintf(stderr, "%s: %s, 探索ノード数 %llu\n", ok ? "解けました" : "解けませんでした", status[result.status], result.nodes);
+	return ok;
+}
+
+// 問題 puzzle（81文字）の解の数を数えて表示する
+static bool su_CountCommand(const SU_RULE *rule, const char *puzzle, int threads, unsigned long long limit) {
+	CSudokuGrid grid;
+	grid.setRule(rule);
+	grid.loadFromString(puzzle);
+	threads = su_GetThreadCount(threads);
+	auto start = std::chrono::steady_clock::now();
+	unsigned long long n = grid.countSolutions(limit, threads);
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%llu%s\n", n, n >= limit ? "+" : "");
+	fprintf(stderr, "%.2f 秒, %d スレッド\n", sec, threads);
+	return true;
+}
+
+// 問題 puzzle（81文字）の各マスについて、少なくとも１つの解でそのマスに入る数字を書き出す
+// １行に９マス分、マスごとに数字を並べて空白で区切る
+static bool su_CandidatesCommand(const SU_RULE *rule, const char *puzzle) {
+	CSudokuGrid grid;
+	grid.setRule(rule);
+	grid.loadFromString(puzzle);
+	auto start = std::chrono::steady_clock::now();
+	int masks[SU_SIZE];
+	int searches = 0;
+	bool found = grid.getSolutionCandidates(masks, &searches);
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (!found) {
+		fprintf(stderr, "解がありません\n");
+		return false;
+	}
+	for (int y=0; y<9; y++) {
+		for (int x=0; x<9; x++) {
+			char s[10];
+			int len = 0;
+			for (int n=1; n<=9; n++) {
+				if (masks[su_IndexOf(x, y)] & su_Bit(n)) s[len++] = (char)('0' + n);
+			}
+			s[len] = '\0';
+			printf(x < 8 ? "%-9s " : "%s", s);
+		}
+		printf("\n");
+	}
+	fprintf(stderr, "%.3f 秒, 探索 %d 回\n", sec, searches);
+	return true;
+}
+
+// 問題 puzzle（81文字）の解をすべて outfile に書き出す（最大 limit 個、limit は 1 以上）
+static bool su_EnumCommand(const SU_RULE *rule, const char *puzzle, const char *outfile, unsigned long long limit) {
+	if (limit == 0) {
+		fprintf(stderr, "上限には 1 以上を指定してください\n");
+		return false;
+	}
+	FILE *out = fopen(outfile, "w");
+	if (out == NULL) {
+		fprintf(stderr, "%s を開けません\n", outfile);
+		return false;
+	}
+	CSudokuGrid grid;
+	grid.setRule(rule);
+	grid.loadFromString(puzzle);
+	unsigned long long n = grid.enumerateSolutions([&](const int *num) {
+		char line[SU_SIZE+2];
+		for (int i=0; i<SU_SIZE; i++) {
+			line[i] = (char)('0' + num[i]);
+		}
+		line[SU_SIZE] = '\n';
+		line[SU_SIZE+1] = '\0';
+		fputs(line, out);
+		return --limit > 0;
+	});
+	fclose(out);
+	fprintf(stderr, "%llu 個の解を書き出しました\n", n);
+	return true;
+}
+
+// 盤面 grid をランダムな変換で count 通りに変えたものを outfile に書き出す
+// 変換は数独の対称群から選ぶ（変則ルールでは数字の付け替えだけ）。grid が問題なら、どれも同じ難しさの問題になる
+static bool su_VariantsCommand(const SU_RULE *rule, const char *grid, long long count, const char *outfile) {
+	FILE *out = fopen(outfile, "w");
+	if (out == NULL) {
+		fprintf(stderr, "%s を開けません\n", outfile);
+		return false;
+	}
+	const int batch = 4096;
+	int src[SU_SIZE];
+	su_ImportNumbers(src, grid);
+	std::vector<SU_TRANSFORM> transforms(batch);
+	std::vector<int> variants(batch * SU_SIZE);
+	bool geometry = rule == su_ClassicRule();
+	double sec = 0; // 変換の作成と適用にかかった時間（書き出しは含めない）
+	for (long long done=0; done<count; ) {
+		int cnt = (int)std::min<long long>(batch, count - done);
+		auto start = std::chrono::steady_clock::now();
+		for (int k=0; k<cnt; k++) {
+			su_RandomTransform(&transforms[k], geometry);
+		}
+		su_ApplyTransforms(transforms.data(), cnt, src, variants.data());
+		sec += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		for (int k=0; k<cnt; k++) {
+			char line[SU_SIZE+2];
+			const int *num = &variants[k * SU_SIZE];
+			for (int i=0; i<SU_SIZE; i++) {
+				line[i] = num[i] > 0 ? (char)('0' + num[i]) : '.';
+			}
+			line[SU_SIZE] = '\n';
+			line[SU_SIZE+1] = '\0';
+			fputs(line, out);
+		}
+		done += cnt;
+	}
+	fclose(out);
+	fprintf(stderr, "%lld 個 (変換 %.3f 秒, %.0f 個/ミリ秒)\n", count, sec, sec > 0 ? count / (sec * 1000) : 0.0);
+	return true;
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// 問題作成パイプライン
+// 正解パターン作成 → 数字を消す → 唯一解の確認 → 難易度判定 → 重複除去と書き出し
+// の各段階を別々のスレッドで動かし、段階の間を固定長のロックフリーキューでつなぐ
+// ---------------------------------------------------------------------------
+
+// 固定長のロックフリーキュー（複数の書き手と複数の読み手で使える）
+// capacity は 2 のべき乗でないといけない
+template <class T> class CSudokuQueue {
+	struct CELL {
+		std::atomic<size_t> seq;
+		T data;
+	};
+	CELL *m_buf;
+	size_t m_mask;
+	std::atomic<size_t> m_head; // 次に書き込む位置
+	std::atomic<size_t> m_tail; // 次に読み込む位置
+public:
+	explicit CSudokuQueue(size_t capacity) {
+		assert(capacity >= 2 && (capacity & (capacity - 1)) == 0);
+		m_buf = new CELL[capacity];
+		m_mask = capacity - 1;
+		for (size_t i=0; i<capacity; i++) {
+			m_buf[i].seq.store(i, std::memory_order_relaxed);
+		}
+		m_head.store(0, std::memory_order_relaxed);
+		m_tail.store(0, std::memory_order_relaxed);
+	}
+	~CSudokuQueue() {
+		delete[] m_buf;
+	}
+
+	// 要素を追加する。満杯なら false
+	bool push(const T &val) {
+		size_t pos = m_head.load(std::memory_order_relaxed);
+		CELL *cell;
+		while (1) {
+			cell = &m_buf[pos & m_mask];
+			size_t seq = cell->seq.load(std::memory_order_acquire);
+			long long dif = (long long)seq - (long long)pos;
+			if (dif == 0) {
+				if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+			} else if (dif < 0) {
+				return false;
+			} else {
+				pos = m_head.load(std::memory_order_relaxed);
+			}
+		}
+		cell->data = val;
+		cell->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// 要素を取り出す。空っぽなら false
+	bool pop(T &val) {
+		size_t pos = m_tail.load(std::memory_order_relaxed);
+		CELL *cell;
+		while (1) {
+			cell = &m_buf[pos & m_mask];
+			size_t seq = cell->seq.load(std::memory_order_acquire);
+			long long dif = (long long)seq - (long long)(pos + 1);
+			if (dif == 0) {
+				if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+			} else if (dif < 0) {
+				return false;
+			} else {
+				pos = m_tail.load(std::memory_order_relaxed);
+			}
+		}
+		val = cell->data;
+		cell->seq.store(pos + m_mask + 1, std::memory_order_release);
+		return true;
+	}
+
+	// 現在の要素数（目安）
+	size_t size() const {
+		size_t head = m_head.load(std::memory_order_relaxed);
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		return head > tail ? head - tail : 0;
+	}
+	size_t capacity() const {
+		return m_mask + 1;
+	}
+};
+
+// キューが空っぽや満杯で待つときに呼ぶ。spins は続けて待った回数（待てたら 0 に戻すこと）
+// しばらくは CPU を譲るだけにし、続くようなら眠る時間を倍々に延ばす（最長 1 ミリ秒）
+// 待っているスレッドが回り続けると、一番遅い段階のスレッドから CPU を奪ってしまう
+static void su_Backoff(int *spins) {
+	if (*spins < 16) {
+		std::this_thread::yield();
+	} else {
+		int us = 10 << std::min(*spins - 16, 7);
+		std::this_thread::sleep_for(std::chrono::microseconds(std::min(us, 1000)));
+	}
+	(*spins)++;
+}
+
+// パイプラインの段階
+enum SU_STAGE_ {
+	SU_STAGE_SYNTH,  // 正解パターンを作る
+	SU_STAGE_DIG,    // 数字を消す
+	SU_STAGE_UNIQUE, // 解が１つしかないことを確かめる
+	SU_STAGE_GRADE,  // 難易度を判定する
+	SU_STAGE_WRITE,  // 重複を取り除いて書き出す
+	SU_STAGE_COUNT
+};
+
+// パイプラインを流れる盤面
+struct SU_PIPEITEM {
+	int num[SU_SIZE];
+	int level;
+	int steps;
+};
+
+static const int SU_PIPE_QUEUE_SIZE = 1024;
+
+class CSudokuPipeline {
+	const SU_RULE *m_rule;
+	SU_GENPARAM m_param;
+	int m_threads[SU_STAGE_COUNT];
+	CSudokuQueue<SU_PIPEITEM> *m_queue[SU_STAGE_COUNT-1]; // m_queue[i] は段階 i から i+1 へのキュー
+	std::atomic<int> m_active[SU_STAGE_COUNT];            // 動いているスレッド数
+	std::atomic<long long> m_done[SU_STAGE_COUNT];        // 処理した数
+	std::atomic<bool> m_stop;
+	FILE *m_out;
+	long long m_target;
+	long long m_written; // 書き出した問題の数
+	long long m_maxattempts;           // 作ってよい正解パターンの数
+	std::atomic<long long> m_attempts; // 作った正解パターンの数
+public:
+	// threads には段階ごとのスレッド数を指定する（書き出しは常に１スレッド）
+	CSudokuPipeline(const SU_RULE *rule, const SU_GENPARAM &param, const int *threads) {
+		m_rule = rule;
+		m_param = param;
+		for (int s=0; s<SU_STAGE_COUNT; s++) {
+			m_threads[s] = s == SU_STAGE_WRITE ? 1 : std::max(1, threads[s]);
+			m_active[s].store(0);
+			m_done[s].store(0);
+		}
+		for (int s=0; s<SU_STAGE_COUNT-1; s++) {
+			m_queue[s] = new CSudokuQueue<SU_PIPEITEM>(SU_PIPE_QUEUE_SIZE);
+		}
+		m_stop.store(false);
+		m_out = NULL;
+		m_target = 0;
+		m_written = 0;
+		m_maxattempts = 0;
+		m_attempts.store(0);
+	}
+	~CSudokuPipeline() {
+		for (int s=0; s<SU_STAGE_COUNT-1; s++) {
+			delete m_queue[s];
+		}
+	}
+
+	// 重複のない問題を count 個作って out に書き出す
+	// 正解パターンを maxattempts 個作っても count 個に届かなければ、そこで諦めて false を返す
+	// 1秒ごとに各段階の処理速度とキューの使用量を stderr に表示する
+	bool run(FILE *out, long long count, long long maxattempts) {
+		m_out = out;
+		m_target = count;
+		m_maxattempts = maxattempts;
+		m_attempts.store(0);
+		std::vector<std::thread> pool;
+		for (int s=0; s<SU_STAGE_COUNT; s++) {
+			m_active[s].store(m_threads[s]);
+			for (int t=0; t<m_threads[s]; t++) {
+				pool.push_back(std::thread(&CSudokuPipeline::worker, this, s, (unsigned)(s * 1000 + t)));
+			}
+		}
+		auto start = std::chrono::steady_clock::now();
+		long long last[SU_STAGE_COUNT] = {0};
+		while (m_active[SU_STAGE_WRITE].load() > 0) {
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+			report(last);
+		}
+		for (size_t i=0; i<pool.size(); i++) {
+			pool[i].join();
+		}
+		double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stderr, "%lld 問 (%.2f 秒)\n", m_written, sec);
+		for (int s=0; s<SU_STAGE_COUNT; s++) {
+			fprintf(stderr, "  %-6s %2d スレッド %10lld 個 %10.1f 個/秒\n", stageName(s), m_threads[s], m_done[s].load(), sec > 0 ? m_done[s].load() / sec : 0.0);
+		}
+		if (m_written < m_target) {
+			fprintf(stderr, "正解パターンを %lld 個作っても、条件を満たす問題が %lld 個しか作れませんでした\n", m_maxattempts, m_written);
+			return false;
+		}
+		return true;
+	}
+
+private:
+	static const char *stageName(int s) {
+		static const char *names[SU_STAGE_COUNT] = {"synth", "dig", "unique", "grade", "write"};
+		return names[s];
+	}
+
+	// 前回からの処理数とキューの使用量を表示する
+	void report(long long *last) {
+		for (int s=0; s<SU_STAGE_COUNT; s++) {
+			long long n = m_done[s].load();
+			fprintf(stderr, "%s %lld/s", stageName(s), n - last[s]);
+			last[s] = n;
+			if (s < SU_STAGE_COUNT-1) {
+				fprintf(stderr, " [%d/%d] ", (int)m_queue[s]->size(), (int)m_queue[s]->capacity());
+			}
+		}
+		fprintf(stderr, "\n");
+	}
+
+	// 段階 stage の盤面 item を処理する。次の段階へ渡すなら true
+	bool process(int stage, SU_PIPEITEM &item, std::unordered_set<std::string> &written) {
+		CSudokuGrid grid;
+		grid.setRule(m_rule);
+		switch (stage) {
+		case SU_STAGE_SYNTH:
+			if (!grid.make()) {
+				return false;
+			}
+			grid.saveToArray(item.num);
+			item.level = SU_LEVEL_NONE;
+			item.steps = 0;
+			return true;
+
+		case SU_STAGE_DIG:
+			{
+				SU_GENSTAT stat;
+				memset(&stat, 0, sizeof(stat));
+				grid.loadFromArray(item.num);
+				if (!grid.digProblem(m_param, &stat)) {
+					return false;
+				}
+				grid.saveToArray(item.num);
+				return true;
+			}
+
+		case SU_STAGE_UNIQUE:
+			grid.loadFromArray(item.num);
+			return grid.countSolutions(2) == 1;
+
+		case SU_STAGE_GRADE:
+			grid.loadFromArray(item.num);
+			item.level = grid.grade(&item.steps);
+			return true;
+
+		case SU_STAGE_WRITE:
+			{
+				char str[SU_SIZE+1];
+				grid.loadFromArray(item.num);
+				grid.saveToString(str);
+				if (!written.insert(str).second) {
+					return false; // 重複
+				}
+				fprintf(m_out, "%s %d %d\n", str, item.level, item.steps);
+				m_written = (long long)written.size();
+				if (m_written >= m_target) {
+					m_stop.store(true);
+				}
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// 段階 stage のスレッド
+	void worker(int stage, unsigned seed) {
+		su_SeedRand(seed); // 乱数の状態はスレッドごとに別々
+		std::unordered_set<std::string> written;
+		SU_PIPEITEM item;
+		CSudokuQueue<SU_PIPEITEM> *in = stage > 0 ? m_queue[stage-1] : NULL;
+		CSudokuQueue<SU_PIPEITEM> *out = stage < SU_STAGE_COUNT-1 ? m_queue[stage] : NULL;
+		int idle = 0; // 入力のキューが空っぽで続けて待った回数
+		while (!m_stop.load(std::memory_order_relaxed)) {
+			if (in == NULL) {
+				// 最初の段階は、作ってよい正解パターンの数を使い切ったら終わる
+				if (m_attempts.fetch_add(1) >= m_maxattempts) {
+					break;
+				}
+			} else {
+				if (!in->pop(item)) {
+					bool finished = m_active[stage-1].load() == 0;
+					if (!in->pop(item)) {
+						if (finished) {
+							break; // 前の段階が終わり、キューも空になった
+						}
+						su_Backoff(&idle);
+						continue;
+					}
+				}
+				idle = 0;
+			}
+			bool keep = process(stage, item, written);
+			m_done[stage].fetch_add(1, std::memory_order_relaxed);
+			if (keep && out) {
+				int full = 0; // 出力のキューが満杯で続けて待った回数
+				while (!out->push(item)) {
+					if (m_stop.load(std::memory_order_relaxed)) break;
+					su_Backoff(&full);
+				}
+			}
+		}
+		m_active[stage].fetch_sub(1);
+	}
+};
+
+#ifndef SU_NO_MAIN // コマンドは main() からしか使わない
+// 問題作成パイプラインで count 個の問題を outfile に書き出す
+// threads は "正解パターン,数字を消す,唯一解の確認,難易度判定" の各スレッド数をカンマ区切りで指定する
+// 正解パターンを maxattempts 個作っても count 個に届かなければ false を返す
+static bool su_PipelineCommand(const SU_RULE *rule, const char *outfile, long long count, const SU_GENPARAM &param, const char *threads, long long maxattempts) {
+	if (count <= 0 || maxattempts <= 0) {
+		fprintf(stderr, "問題数と最大試行回数には 1 以上を指定してください\n");
+		return false;
+	}
+	FILE *out = fopen(outfile, "w");
+	if (out == NULL) {
+		fprintf(stderr, "%s を開けません\n", outfile);
+		return false;
+	}
+	int nthreads[SU_STAGE_COUNT] = {1, su_GetThreadCount(0), 1, 1, 1};
+	if (threads) {
+		const char *c = threads;
+		for (int s=0; s<SU_STAGE_WRITE && *c; s++) {
+			nthreads[s] = atoi(c);
+			while (*c && *c != ',') c++;
+			if (*c == ',') c++;
+		}
+	}
+	CSudokuPipeline *pipe = new CSudokuPipeline(rule, param, nthreads);
+	bool ok = pipe->run(out, count, maxattempts);
+	delete pipe;
+	fclose(out);
+	return ok;
+}
+#endif
+
+// 数値を入力してもらう
+static int su_InputInt(const char *prompt, int defval) {
+	printf("%s", prompt);
+	char s[256] = {0};
+	fgets(s, 256, stdin);
+	if (!isdigit((unsigned char)s[0])) {
+		return defval;
+	}
+	return atoi(s);
+}
+
+// 条件を指定して問題を作る
+void genEx() {
+	SU_GENPARAM param;
+	memset(&param, 0, sizeof(param));
+	printf("---------------------------------\n");
+	printf("■条件を指定して問題を作ります。\n");
+	printf("　何も入力せずにエンターキーを押すと [] 内の値になります\n");
+	printf("\n");
+	param.clues = su_InputInt("ヒント数 (17～81, 0=制限なし) [0] > ", 0);
+	printf("対称性\n");
+	printf("  [0] なし\n");
+	printf("  [1] 180度回転対称\n");
+	printf("  [2] 90度回転対称\n");
+	printf("  [3] 左右対称\n");
+	printf("  [4] 上下対称\n");
+	printf("  [5] 対角線対称\n");
+	param.symmetry = su_InputInt("> [0] ", SU_SYM_NONE);
+	printf("難易度\n");
+	printf("  [0] 問わない\n");
+	printf("  [1] 空きマスが１つしかない行・列・ブロックだけで解ける\n");
+	printf("  [2] 行・列・ブロックの中で数字が入る場所を探す必要がある\n");
+	printf("  [3] マスに入る数字が１つしかないことを見抜く必要がある\n");
+	param.level = su_InputInt("> [0] ", SU_LEVEL_NONE);
+	param.maxtries = su_InputInt("最大試行回数 [1000] > ", 1000);
+	if (param.symmetry < 0 || SU_SYM_COUNT <= param.symmetry) {
+		param.symmetry = SU_SYM_NONE;
+	}
+	if (param.level < 0 || SU_LEVEL_MAX < param.level) {
+		param.level = SU_LEVEL_NONE;
+	}
+	printf("\n");
+
+	CSudokuGrid grid;
+	SU_GENSTAT stat;
+	bool ok = grid.makeProblem(param, &stat);
+	if (ok) {
+		char str[SU_SIZE+1];
+		grid.saveToString(str);
+		grid.print();
+		printf("%s\n", str);
+		printf("ヒント数: %d\n", grid.getClueCount());
+	} else {
+		su_SetConsoleTextAttr(TEXTATTR_ERR);
+		printf("条件を満たす問題を作れませんでした\n");
+		su_SetConsoleTextAttr(TEXTATTR_NONE);
+	}
+	printf("正解パターン: %d 個, 解答チェック: %d 回, ヒント数で棄却: %d, 難易度で棄却: %d, 回避不能集合で省略: %d\n",
+		stat.tries, stat.solves, stat.rejectClues, stat.rejectLevel, stat.skips);
+}
+
 // 問題解く
 void solve() {
 	char str[256] = {0};
@@ -918,6 +3702,12 @@ void solve() {
 		grid.stepSolve();
 		grid.print();
 
+		if (grid.hasError()) {
+			su_SetConsoleTextAttr(TEXTATTR_ERR);
+			printf("[エラー] 数字が重複しています");
+			su_SetConsoleTextAttr(TEXTATTR_NONE);
+			printf("\n\n");
+		}
 		if (grid.isSolved()) {
 			printf("\n");
 			su_SetConsoleTextAttr(TEXTATTR_MSG);
@@ -932,10 +3722,143 @@ void solve() {
 	} while (getchar());
 }
 
-int main() {
+// ルールの指定 spec を読む。カンマ区切りで次のものを組み合わせる
+//   x              対角線にも同じ数字が入らない
+//   window         ４つの窓にも同じ数字が入らない
+//   jigsaw:<81文字> ブロックの代わりに不定形の領域を使う（各マスの領域番号 1～9）
+static bool su_ParseRule(const char *spec, SU_RULE *rule) {
+	int flags = SU_RULE_CLASSIC;
+	const char *regions = NULL;
+	const char *c = spec;
+	while (*c) {
+		size_t len = strcspn(c, ","); // 項目の長さ
+		if (len == 1 && c[0] == 'x') {
+			flags |= SU_RULE_X;
+		} else if (len == 6 && strncmp(c, "window", 6) == 0) {
+			flags |= SU_RULE_WINDOW;
+		} else if (len == 7 + SU_SIZE && strncmp(c, "jigsaw:", 7) == 0) {
+			regions = c + 7;
+		} else {
+			return false;
+		}
+		c += len;
+		if (*c == ',') c++;
+	}
+	if (!su_InitRule(rule, flags, regions)) {
+		return false;
+	}
+	// 空っぽの盤面に解がないルール（領域の形によってはありうる）は使えない
+	CSudokuDLX *dlx = new CSudokuDLX(rule);
+	bool ok = dlx->count(1) > 0;
+	delete dlx;
+	return ok;
+}
+
+#ifndef SU_NO_MAIN // テストから取り込むときは main() とコマンドの振り分けを除く
+// コマンドラインから一括処理する
+static int su_RunCommand(int argc, char *argv[]) {
+	// 最初の引数が --rule=xxx ならルールを変える
+	static SU_RULE rule;
+	const SU_RULE *prule = su_ClassicRule();
+	if (argc >= 2 && strncmp(argv[1], "--rule=", 7) == 0) {
+		if (!su_ParseRule(argv[1] + 7, &rule)) {
+			fprintf(stderr, "ルールの指定が正しくありません: %s\n", argv[1]);
+			return 1;
+		}
+		prule = &rule;
+		argv[1] = argv[0];
+		argc--;
+		argv++;
+	}
+	if (argc >= 4 && strcmp(argv[1], "grade") == 0) {
+		int threads = argc >= 5 ? atoi(argv[4]) : 0;
+		return su_GradeCorpus(prule, argv[2], argv[3], threads) ? 0 : 1;
+	}
+	if (argc >= 3 && strcmp(argv[1], "verify") == 0) {
+		int threads = argc >= 4 ? atoi(argv[3]) : 0;
+		return su_VerifyCorpus(prule, argv[2], threads) ? 0 : 1;
+	}
+	if (argc >= 4 && strcmp(argv[1], "minimal") == 0) {
+		int threads = argc >= 5 ? atoi(argv[4]) : 0;
+		return su_MinimalCorpus(prule, argv[2], argv[3], threads) ? 0 : 1;
+	}
+	if (argc >= 3 && strcmp(argv[1], "solve") == 0) {
+		long long timeout = argc >= 4 ? atoll(argv[3]) : 0;
+		unsigned long long maxnodes = argc >= 5 ? strtoull(argv[4], NULL, 10) : 0;
+		return su_SolveCommand(prule, argv[2], timeout, maxnodes) ? 0 : 1;
+	}
+	if (argc >= 3 && strcmp(argv[1], "count") == 0) {
+		int threads = argc >= 4 ? atoi(argv[3]) : 0;
+		unsigned long long limit = argc >= 5 ? strtoull(argv[4], NULL, 10) : ~0ULL;
+		return su_CountCommand(prule, argv[2], threads, limit) ? 0 : 1;
+	}
+	if (argc >= 3 && strcmp(argv[1], "candidates") == 0) {
+		return su_CandidatesCommand(prule, argv[2]) ? 0 : 1;
+	}
+	if (argc >= 4 && strcmp(argv[1], "enum") == 0) {
+		unsigned long long limit = ~0ULL;
+		if (argc >= 5) {
+			long long n = atoll(argv[4]);
+			if (n <= 0) {
+				fprintf(stderr, "上限には 1 以上を指定してください\n");
+				return 1;
+			}
+			limit = (unsigned long long)n;
+		}
+		return su_EnumCommand(prule, argv[2], argv[3], limit) ? 0 : 1;
+	}
+	if (argc >= 5 && strcmp(argv[1], "variants") == 0) {
+		return su_VariantsCommand(prule, argv[2], atoll(argv[3]), argv[4]) ? 0 : 1;
+	}
+	if (argc >= 4 && strcmp(argv[1], "pipeline") == 0) {
+		SU_GENPARAM param;
+		memset(&param, 0, sizeof(param));
+		param.clues = argc >= 5 ? atoi(argv[4]) : 0;
+		param.symmetry = argc >= 6 ? atoi(argv[5]) : SU_SYM_NONE;
+		param.level = argc >= 7 ? atoi(argv[6]) : SU_LEVEL_NONE;
+		param.maxtries = 1;
+		if (param.symmetry < 0 || SU_SYM_COUNT <= param.symmetry) {
+			param.symmetry = SU_SYM_NONE;
+		}
+		if (param.level < 0 || SU_LEVEL_MAX < param.level) {
+			param.level = SU_LEVEL_NONE;
+		}
+		long long count = atoll(argv[3]);
+		long long maxattempts = argc >= 9 ? atoll(argv[8]) : count * 1000;
+		return su_PipelineCommand(prule, argv[2], count, param, argc >= 8 ? argv[7] : NULL, maxattempts) ? 0 : 1;
+	}
+	fprintf(stderr, "使い方:\n");
+	fprintf(stderr, "  %s                                  対話モード\n", argv[0]);
+	fprintf(stderr, "  %s [--rule=ルール] <コマンド> ...\n", argv[0]);
+	fprintf(stderr, "      ルールは x（対角線）, window（窓）, jigsaw:<各マスの領域番号81文字> をカンマ区切りで\n");
+	fprintf(stderr, "  %s grade <問題集> <出力> [スレッド数]  難易度を一括判定する\n", argv[0]);
+	fprintf(stderr, "  %s verify <解答集> [スレッド数]        解答が正しいか一括で確かめる\n", argv[0]);
+	fprintf(stderr, "  %s minimal <問題集> <出力> [スレッド数] 問題が最小か一括で調べる\n", argv[0]);
+	fprintf(stderr, "  %s solve <問題> [ミリ秒] [ノード数]    制限つきで問題を解く\n", argv[0]);
+	fprintf(stderr, "  %s count <問題> [スレッド数] [上限]   解の数を数える\n", argv[0]);
+	fprintf(stderr, "  %s candidates <問題>                  各マスで解に現れる数字を書き出す\n", argv[0]);
+	fprintf(stderr, "  %s enum <問題> <出力> [上限]         解をすべて書き出す\n", argv[0]);
+	fprintf(stderr, "  %s variants <盤面> <個数> <出力>      盤面を対称変換で作り変えたものを書き出す\n", argv[0]);
+	fprintf(stderr, "  %s pipeline <出力> <問題数> [ヒント数] [対称性] [難易度] [スレッド数] [最大試行回数]\n", argv[0]);
+	fprintf(stderr, "      問題を一括作成する。スレッド数は 正解パターン,数字を消す,唯一解の確認,難易度判定 をカンマ区切りで\n");
+	fprintf(stderr, "      最大試行回数は作ってよい正解パターンの数（省略時は問題数の 1000 倍）\n");
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+#ifdef SU_PROFILE
+	atexit(su_ProfileDumpAtExit);
+#endif
+	if (argc >= 2) {
+		return su_RunCommand(argc, argv);
+	}
 	while (1) {
 		printf("[1] パターンを作る\n");
 		printf("[2] 問題を解く\n");
+		printf("[3] 条件を指定して問題を作る\n");
+#ifdef SU_PROFILE
+		printf("[9] 計測値を出力する\n");
+#endif
 		printf("[0] 終了\n");
 		printf(">> ");
 		char c = getchar();
@@ -949,10 +3872,23 @@ int main() {
 			solve();
 			return 0;
 		}
+		if (c == '3') {
+			getchar(); // skip \n
+			genEx();
+			return 0;
+		}
+#ifdef SU_PROFILE
+		if (c == '9') {
+			getchar(); // skip \n
+			su_ProfileDump(stdout);
+			continue;
+		}
+#endif
 		if (c == '0') {
 			getchar(); // skip \n
 			return 0;
 		}
 	}
 	return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,413 @@
+/// Copyright (c) 2020 Heliodor 
+/// This software is released under the MIT License.
+/// http://opensource.org/licenses/mit-license.php
+
+// sudoku.cpp の回帰テスト
+// main() を除いた sudoku.cpp をそのまま取り込み、内部の関数を直接呼んで確かめる
+#define SU_NO_MAIN
+#include "../sudoku.cpp"
+#include <set>
+
+static int su_TestFailures = 0;
+
+#define SU_CHECK(expr) do { \
+	if (!(expr)) { \
+		fprintf(stderr, "%s(%d): 失敗: %s\n", __FILE__, __LINE__, #expr); \
+		su_TestFailures++; \
+	} \
+} while (0)
+
+// 唯一解の問題
+static const char su_TestUnique[] =
+	".19..68..........2..8....4...4.3.......24..67.....8.2.3....16..182.......9.7...8.";
+// 解が 49032 個ある問題
+static const char su_TestSparse[] =
+	".1.7..6....3.82..5..5.....31...37............2.71.........743......26.....6....5.";
+// 同じハウスに重複はないが、数字を確定させていくと矛盾する問題（解なし）
+static const char su_TestContradiction[] =
+	"12345678.........9........1........2........3........4........5........6........7";
+
+// 解の数を数える（１スレッドと複数スレッドで同じになる）
+static void su_TestCount() {
+	int num[SU_SIZE];
+	su_ImportNumbers(num, su_TestUnique);
+	SU_CHECK(su_CountSolutions(su_ClassicRule(), num, ~0ULL, 1) == 1);
+	su_ImportNumbers(num, su_TestSparse);
+	SU_CHECK(su_CountSolutions(su_ClassicRule(), num, ~0ULL, 1) == 49032);
+	SU_CHECK(su_CountSolutions(su_ClassicRule(), num, ~0ULL, 4) == 49032);
+	SU_CHECK(su_CountSolutions(su_ClassicRule(), num, 100, 4) == 100);
+	su_ImportNumbers(num, su_TestContradiction);
+	SU_CHECK(su_CountSolutions(su_ClassicRule(), num, ~0ULL, 1) == 0);
+	SU_CHECK(su_CountSolutions(su_ClassicRule(), num, ~0ULL, 4) == 0);
+
+	// 一番上のバンドだけの盤面（下の２つのバンドは式で数える。１マスずつ埋めると数分かかる）
+	su_ImportNumbers(num, "123456789456789123789123456");
+	SU_CHECK(su_CountSolutions(su_ClassicRule(), num, ~0ULL, 1) == 7802998272ULL);
+	SU_CHECK(su_CountSolutions(su_ClassicRule(), num, ~0ULL, 4) == 7802998272ULL);
+}
+
+// 解いた盤面が正解で、問題の数字と一致する
+static void su_TestSolve() {
+	int puzzle[SU_SIZE];
+	int answer[SU_SIZE];
+	su_ImportNumbers(puzzle, su_TestUnique);
+	CSudokuGrid grid;
+	grid.loadFromArray(puzzle);
+	SU_SEARCHRESULT result;
+	SU_CHECK(grid.solve(SU_LIMIT(), &result));
+	SU_CHECK(result.count == 1);
+	SU_CHECK(grid.isSolved());
+	grid.saveToArray(answer);
+	for (int i=0; i<SU_SIZE; i++) {
+		SU_CHECK(puzzle[i] == 0 || puzzle[i] == answer[i]);
+	}
+}
+
+// 最小性の判定
+static void su_TestMinimal() {
+	int redundant[SU_SIZE];
+	int cnt = 0;
+	CSudokuGrid grid;
+	grid.loadFromString(su_TestUnique);
+	SU_CHECK(grid.checkMinimal(redundant, &cnt) == SU_MINIMAL_YES);
+	SU_CHECK(cnt == 0);
+
+	// 解答の数字を１つ足すと、その数字は消しても唯一解のまま
+	int answer[SU_SIZE];
+	CSudokuGrid solved = grid;
+	SU_SEARCHRESULT result;
+	solved.solve(SU_LIMIT(), &result);
+	solved.saveToArray(answer);
+	int c = 0;
+	while (grid.get(c % 9, c / 9) != 0) c++;
+	grid.set(c % 9, c / 9, answer[c]);
+	SU_CHECK(grid.checkMinimal(redundant, &cnt) == SU_MINIMAL_NO);
+	SU_CHECK(std::find(redundant, redundant + cnt, c) != redundant + cnt);
+
+	grid.loadFromString(su_TestSparse);
+	SU_CHECK(grid.checkMinimal(redundant, &cnt) == SU_MINIMAL_NOT_UNIQUE);
+	grid.loadFromString(su_TestContradiction);
+	SU_CHECK(grid.checkMinimal(redundant, &cnt) == SU_MINIMAL_NO_SOLUTION);
+}
+
+// 変換の合成
+static void su_TestTransform() {
+	CSudokuGrid grid;
+	grid.make();
+	int src[SU_SIZE];
+	grid.saveToArray(src);
+	su_SeedRand(1);
+	for (int k=0; k<100; k++) {
+		SU_TRANSFORM a, b, ab;
+		su_RandomTransform(&a, true);
+		su_RandomTransform(&b, true);
+		su_ComposeTransform(&ab, a, b);
+		int t1[SU_SIZE], t2[SU_SIZE], t3[SU_SIZE];
+		su_ApplyTransform(a, src, t1);
+		su_ApplyTransform(b, t1, t2);
+		su_ApplyTransform(ab, src, t3);
+		SU_CHECK(memcmp(t2, t3, sizeof(t2)) == 0);
+
+		// 変換しても正解パターンのまま
+		CSudokuGrid g;
+		g.loadFromArray(t3);
+		SU_CHECK(g.isSolved());
+	}
+
+	// 行の入れ替えを２回やると元に戻る
+	SU_TRANSFORM r, rr;
+	su_RowSwapTransform(&r, 0, 2);
+	su_ComposeTransform(&rr, r, r);
+	int t[SU_SIZE];
+	su_ApplyTransform(rr, src, t);
+	SU_CHECK(memcmp(src, t, sizeof(t)) == 0);
+}
+
+// 矛盾する問題でも止まる
+static void su_TestContradictionPuzzle() {
+	CSudokuGrid grid;
+	grid.loadFromString(su_TestContradiction);
+	SU_CHECK(!grid.hasError());
+	int steps = 0;
+	SU_CHECK(grid.grade(&steps) == SU_LEVEL_NONE);
+	SU_CHECK(steps == 1); // 最初の確定で重複が生じたところで止まる
+	grid.loadFromString(su_TestContradiction);
+	SU_CHECK(!grid.canSolve());
+
+	// 制限つきで解く：すぐに「解なし」で終わる
+	SU_LIMIT limit;
+	limit.setTimeout(1000);
+	limit.maxnodes = 1000;
+	SU_SEARCHRESULT result;
+	grid.loadFromString(su_TestContradiction);
+	SU_CHECK(!grid.solve(limit, &result));
+	SU_CHECK(result.status == SU_SEARCH_DONE);
+	SU_CHECK(result.count == 0);
+
+	// 数字の確定もノード数の制限に含まれる
+	limit.maxnodes = 5;
+	grid.loadFromString(su_TestUnique);
+	SU_CHECK(!grid.solve(limit, &result));
+	SU_CHECK(result.status == SU_SEARCH_BUDGET);
+	SU_CHECK(result.nodes <= 5);
+}
+
+// ルールの指定は項目ごとに完全一致で読む。変則ルールの正解パターンは毎回違う
+static void su_TestRule() {
+	static SU_RULE rule;
+	SU_CHECK(!su_ParseRule("windows", &rule));
+	SU_CHECK(!su_ParseRule("xx", &rule));
+	// 領域の大きさは正しいが、空っぽの盤面にも解がない（(0,0) と (0,1) に同じ数字が要る）
+	static const char bad[] = "jigsaw:211111111122222222333333333444444444555555555666666666777777777888888888999999999";
+	SU_CHECK(!su_ParseRule(bad, &rule));
+	static SU_RULE badrule;
+	SU_CHECK(su_InitRule(&badrule, SU_RULE_CLASSIC, bad + 7));
+	CSudokuGrid badgrid;
+	badgrid.setRule(&badrule);
+	SU_CHECK(!badgrid.make());
+	CSudokuGrid badgen;
+	badgen.setRule(&badrule);
+	SU_GENPARAM param;
+	memset(&param, 0, sizeof(param));
+	param.maxtries = 10;
+	SU_CHECK(!badgen.makeProblem(param));
+	SU_CHECK(su_ParseRule("window,x", &rule));
+	su_SeedRand(1);
+	CSudokuGrid grid;
+	grid.setRule(&rule);
+	grid.make();
+	SU_CHECK(grid.isSolved());
+	int a[SU_SIZE], b[SU_SIZE];
+	grid.saveToArray(a);
+	grid.make();
+	SU_CHECK(grid.isSolved());
+	grid.saveToArray(b);
+	SU_CHECK(memcmp(a, b, sizeof(a)) != 0);
+}
+
+// 回避不能集合：空きマスのある盤面からは作らない。対話で数字を消しても唯一解のまま
+static void su_TestUnavoidables() {
+	CSudokuGrid grid;
+	grid.loadFromString(su_TestUnique);
+	int num[SU_SIZE];
+	grid.saveToArray(num);
+	CSudokuUnavoidables sets;
+	sets.build(su_ClassicRule(), num);
+	SU_CHECK(sets.getCount() == 0);
+
+	su_SeedRand(1);
+	grid.make();
+	grid.shuffle(100);
+	grid.saveToArray(num);
+	sets.build(su_ClassicRule(), num);
+	SU_CHECK(sets.getCount() > 0);
+	int removed = 0;
+	while (grid.removeRandomOne()) {
+		removed++;
+		SU_CHECK(grid.canSolve());
+	}
+	SU_CHECK(removed > 40);
+	SU_CHECK(grid.countSolutions(2) == 1);
+}
+
+// ミニ行（ブロックの中の横３マス）の数字の組が何種類あるか
+// 行・列の入れ替えと数字の付け替えでは変わらないので、正解パターンの違いの目安になる
+static int su_TestMiniRowSets(const int *num) {
+	std::set<int> sets;
+	for (int y=0; y<9; y++) {
+		for (int bx=0; bx<3; bx++) {
+			int bits = 0;
+			for (int x=bx*3; x<bx*3+3; x++) {
+				bits |= su_Bit(num[su_IndexOf(x, y)]);
+			}
+			sets.insert(bits);
+		}
+	}
+	return (int)sets.size();
+}
+
+// 問題作成：正解パターンは毎回違う形になり、ヒント数・対称性・難易度の条件を守る
+static void su_TestMakeProblem() {
+	su_SeedRand(1);
+	std::set<int> kinds;
+	for (int k=0; k<20; k++) {
+		CSudokuGrid grid;
+		SU_CHECK(grid.make());
+		SU_CHECK(grid.isSolved());
+		int num[SU_SIZE];
+		grid.saveToArray(num);
+		kinds.insert(su_TestMiniRowSets(num));
+	}
+	SU_CHECK(kinds.size() > 1);
+
+	SU_GENPARAM param;
+	memset(&param, 0, sizeof(param));
+	param.clues = 30;
+	param.symmetry = SU_SYM_ROT180;
+	param.level = SU_LEVEL_NORMAL;
+	param.maxtries = 300;
+	CSudokuGrid grid;
+	SU_CHECK(grid.makeProblem(param));
+	SU_CHECK(grid.getClueCount() == 30);
+	int num[SU_SIZE];
+	grid.saveToArray(num);
+	for (int i=0; i<SU_SIZE; i++) {
+		SU_CHECK((num[i] > 0) == (num[SU_SIZE-1-i] > 0));
+	}
+	SU_CHECK(grid.canSolve(SU_LEVEL_NORMAL));
+	SU_CHECK(!grid.canSolve(SU_LEVEL_EASY));
+	SU_CHECK(grid.countSolutions(2) == 1);
+
+	// 90度回転対称ではヒント数は 4 の倍数か、それに 1 を足したものだけ。作れないものは正解パターンを作らずに諦める
+	SU_CHECK(su_CluesReachable(SU_SYM_ROT90, 28));
+	SU_CHECK(su_CluesReachable(SU_SYM_ROT90, 29));
+	SU_CHECK(!su_CluesReachable(SU_SYM_ROT90, 30));
+	SU_CHECK(su_CluesReachable(SU_SYM_NONE, 30));
+	SU_GENSTAT stat;
+	param.clues = 30;
+	param.symmetry = SU_SYM_ROT90;
+	SU_CHECK(!grid.makeProblem(param, &stat));
+	SU_CHECK(stat.tries == 0);
+	SU_CHECK(stat.solves == 0);
+}
+
+// パイプラインのキュー：満杯・空っぽを正しく返し、複数の書き手と読み手でも要素をちょうど１回ずつ渡す
+static void su_TestQueue() {
+	CSudokuQueue<int> small(4);
+	for (int i=0; i<4; i++) {
+		SU_CHECK(small.push(i));
+	}
+	SU_CHECK(!small.push(4));
+	int v;
+	for (int i=0; i<4; i++) {
+		SU_CHECK(small.pop(v) && v == i);
+	}
+	SU_CHECK(!small.pop(v));
+
+	const int writers = 4, readers = 4, per = 20000;
+	CSudokuQueue<int> queue(64);
+	std::vector<std::atomic<int> > seen(writers * per);
+	for (size_t i=0; i<seen.size(); i++) seen[i].store(0);
+	std::atomic<int> popped(0);
+	std::vector<std::thread> pool;
+	for (int w=0; w<writers; w++) {
+		pool.push_back(std::thread([&, w]() {
+			for (int i=0; i<per; i++) {
+				while (!queue.push(w * per + i)) std::this_thread::yield();
+			}
+		}));
+	}
+	for (int r=0; r<readers; r++) {
+		pool.push_back(std::thread([&]() {
+			int x;
+			while (popped.load() < writers * per) {
+				if (queue.pop(x)) {
+					seen[x].fetch_add(1);
+					popped.fetch_add(1);
+				} else {
+					std::this_thread::yield();
+				}
+			}
+		}));
+	}
+	for (size_t i=0; i<pool.size(); i++) {
+		pool[i].join();
+	}
+	int bad = 0;
+	for (size_t i=0; i<seen.size(); i++) {
+		if (seen[i].load() != 1) bad++;
+	}
+	SU_CHECK(bad == 0);
+	SU_CHECK(!queue.pop(v));
+}
+
+// set() で数字を上書きしたり消したりしても、マスの数と重複の数が合っている
+static void su_TestCounters() {
+	CSudokuGrid grid;
+	grid.loadFromString(su_TestUnique);
+	int clues = 0;
+	for (int i=0; i<SU_SIZE; i++) {
+		if (su_TestUnique[i] != '.') clues++;
+	}
+	SU_CHECK(grid.getClueCount() == clues);
+	SU_CHECK(!grid.hasError());
+
+	// 空きマス (0,0) に、同じ行の (1,0) と同じ 1 を入れると重複する。上書きで直し、消すと元に戻る
+	grid.set(0, 0, 1);
+	SU_CHECK(grid.getClueCount() == clues + 1);
+	SU_CHECK(grid.hasError());
+	grid.set(0, 0, 2);
+	SU_CHECK(grid.getClueCount() == clues + 1);
+	SU_CHECK(!grid.hasError());
+	grid.set(0, 0, 0);
+	SU_CHECK(grid.getClueCount() == clues);
+	SU_CHECK(!grid.hasError());
+
+	// ヒント (1,0) の 1 を同じ行の 9 で上書きすると重複し、戻すと消える
+	grid.set(1, 0, 9);
+	SU_CHECK(grid.getClueCount() == clues);
+	SU_CHECK(grid.hasError());
+	grid.set(1, 0, 1);
+	SU_CHECK(!grid.hasError());
+
+	// 完成した盤面から１マス消すと未完成、戻すと完成
+	grid.loadFromString("219476835647385912538192746924637158851249367763518429375821694182964573496753281");
+	SU_CHECK(grid.isSolved());
+	grid.set(4, 4, 0);
+	SU_CHECK(grid.getClueCount() == SU_SIZE - 1);
+	SU_CHECK(!grid.isSolved());
+	SU_CHECK(!grid.hasError());
+	grid.set(4, 4, 4);
+	SU_CHECK(grid.isSolved());
+}
+
+// 解の候補が、すべての解を列挙して各マスの数字を集めたものと一致する
+static void su_TestSolutionCandidates() {
+	int num[SU_SIZE];
+	su_ImportNumbers(num, su_TestSparse);
+	int expect[SU_SIZE] = {0};
+	CSudokuDLX dlx;
+	dlx.load(num);
+	unsigned long long n = dlx.enumerate([&](const int *sol) {
+		for (int i=0; i<SU_SIZE; i++) {
+			expect[i] |= su_Bit(sol[i]);
+		}
+		return true;
+	});
+	SU_CHECK(n == 49032);
+
+	CSudokuGrid grid;
+	grid.loadFromString(su_TestSparse);
+	int masks[SU_SIZE];
+	int searches = 0;
+	SU_CHECK(grid.getSolutionCandidates(masks, &searches));
+	SU_CHECK(memcmp(masks, expect, sizeof(masks)) == 0);
+	SU_CHECK(searches > 0 && searches <= 1 + SU_SIZE * 9);
+
+	// 解のない問題ではすべて 0
+	grid.loadFromString(su_TestContradiction);
+	SU_CHECK(!grid.getSolutionCandidates(masks));
+	for (int i=0; i<SU_SIZE; i++) {
+		SU_CHECK(masks[i] == 0);
+	}
+}
+
+int main() {
+	su_TestCount();
+	su_TestSolve();
+	su_TestMinimal();
+	su_TestTransform();
+	su_TestContradictionPuzzle();
+	su_TestRule();
+	su_TestUnavoidables();
+	su_TestMakeProblem();
+	su_TestQueue();
+	su_TestCounters();
+	su_TestSolutionCandidates();
+	if (su_TestFailures > 0) {
+		fprintf(stderr, "%d 個のテストが失敗しました\n", su_TestFailures);
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}